@@ -24,15 +24,98 @@ limitations under the License.
 #define ADC_CHANNEL_POTENTIOMETER ADC_CHANNEL_5
 #define ADC_CHANNEL_TEMPERATURE_SENSOR ADC_CHANNEL_4
 
+/* Each channel indexes the channel table in adc.c, which holds its
+ * analog input and pin.  Add a channel there and before
+ * ADC_CHANNEL_COUNT here; at most 16. */
 typedef enum
 {
-    ADC_CHANNEL_5 = 5,
-    ADC_CHANNEL_4 = 4
+    ADC_CHANNEL_5,
+    ADC_CHANNEL_4,
+    /* AN pins of the mikroBUS sockets, RB10 and RB1. */
+    ADC_CHANNEL_10,
+    ADC_CHANNEL_1,
+    ADC_CHANNEL_COUNT
 } ADC_CHANNEL;
 
+/* Called from the ADC interrupt when a conversion started with
+ * ADC_StartWithCallback() completes. */
+typedef void (*ADC_CALLBACK)(ADC_CHANNEL channel, uint16_t result, void *context);
+
+/* Called from the ADC interrupt when the last sample of a burst started
+ * with ADC_CaptureBurstWithCallback() is stored. */
+typedef void (*ADC_CAPTURE_CALLBACK)(ADC_CHANNEL channel, uint16_t count, void *context);
+
+#if defined(ADC_ENABLE_STATISTICS)
+/* Figures of one channel since its statistics were last reset, collected
+ * when ADC_ENABLE_STATISTICS is defined for the whole project.  Values
+ * are in result counts; the fractional ones have 8 fractional bits. */
+typedef struct
+{
+    uint16_t count;
+    uint16_t min;
+    uint16_t max;
+    /* Mean times 256. */
+    uint32_t mean_q8;
+    /* Population variance times 256.  A full scale 14-bit signal can
+     * exceed 32 bits here. */
+    uint64_t variance_q8;
+} ADC_STATISTICS;
+#endif
+
+/* Writes one byte of an export, for example putU2().  Returns -1 if the
+ * byte could not be written. */
+typedef int (*ADC_EXPORT_PUTC)(int c);
+
+/* Returned by ADC_ToTemperature() for a failed read. */
+#define ADC_TEMPERATURE_INVALID ((int16_t)0x8000)
+
+/* Where a channel is relative to the window of ADC_SetThreshold(). */
+typedef enum
+{
+    ADC_ZONE_BELOW,
+    ADC_ZONE_INSIDE,
+    ADC_ZONE_ABOVE
+} ADC_ZONE;
+
+/* Called from the ADC interrupt when a channel moves to another zone. */
+typedef void (*ADC_THRESHOLD_CALLBACK)(ADC_CHANNEL channel, ADC_ZONE zone, uint16_t value);
+
+/* Filter run on every sample of a channel by the ADC interrupt, see
+ * ADC_SetFilter().  All are integer only. */
+typedef enum
+{
+    /* The filtered value is the newest sample. */
+    ADC_FILTER_NONE,
+    /* Mean of the last parameter samples, a power of two up to
+     * ADC_FILTER_MAX_TAPS, kept as a running sum. */
+    ADC_FILTER_MOVING_AVERAGE,
+    /* First-order low pass y += a * (x - y), with the coefficient a given
+     * as parameter in Q15 (1 to 32767, 32768 * a). */
+    ADC_FILTER_IIR,
+    /* Median of the last parameter samples, 3 or 5, which removes single
+     * spikes without smearing steps. */
+    ADC_FILTER_MEDIAN
+} ADC_FILTER_TYPE;
+
 typedef enum
 {
-    ADC_CONFIGURATION_DEFAULT
+    ADC_CONFIGURATION_DEFAULT,
+    /* As ADC_CONFIGURATION_DEFAULT, with 12-bit conversions. */
+    ADC_CONFIGURATION_12BIT,
+    /* Each conversion started with ADC_Start() is repeated
+     * ADC_OVERSAMPLE_COUNT times by the hardware into the result buffers,
+     * and the single interrupt at the end decimates the sum to a
+     * 12 + log2(ADC_OVERSAMPLE_COUNT) / 2 bit result, see
+     * ADC_GetResolution(). */
+    ADC_CONFIGURATION_OVERSAMPLE,
+    /* All enabled channels are sampled and converted back to back by the
+     * hardware.  The ADC interrupt stores each scan, and ADC_Read10bit()
+     * and ADC_ReadLatest() return the newest stored sample. */
+    ADC_CONFIGURATION_SCAN,
+    /* As ADC_CONFIGURATION_SCAN, but each conversion is started by a
+     * Timer1 period match so samples are evenly spaced in time.  The rate
+     * is set with ADC_SetSampleRate(). */
+    ADC_CONFIGURATION_TIMED
 } ADC_CONFIGURATION;
 
 /*********************************************************************
@@ -71,11 +154,362 @@ uint8_t ADC_ReadPercentage(ADC_CHANNEL channel);
 *         i.e. - ADCReadPercentage(ADC_CHANNEL_POTENTIOMETER);
 *
 * Output: uint16_t the right adjusted 10-bit representation of the ADC
-*         channel conversion or 0xFFFF for an error.
+*         channel conversion or 0xFFFF for an error.  Results of the
+*         12-bit and oversampling configurations are scaled down.
 *
 ********************************************************************/
 uint16_t ADC_Read10bit(ADC_CHANNEL channel);
 
+/*********************************************************************
+* Function: ADC_Read(ADC_CHANNEL channel);
+*
+* Overview: Reads the requested ADC channel at the full resolution of
+*           the configuration, see ADC_GetResolution().
+*
+* PreCondition: channel is enabled via ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to read
+*
+* Output: uint16_t the right adjusted result or 0xFFFF for an error.
+*
+********************************************************************/
+uint16_t ADC_Read(ADC_CHANNEL channel);
+
+/*********************************************************************
+* Function: uint8_t ADC_GetResolution(void);
+*
+* Overview: Returns the number of bits in the results of ADC_Read(),
+*           ADC_GetResult() and the conversion callbacks: 10, 12, or
+*           13 to 14 when oversampling.
+*
+* PreCondition: ADC_SetConfiguration() called
+*
+* Input: None
+*
+* Output: uint8_t - result width in bits
+*
+********************************************************************/
+uint8_t ADC_GetResolution(void);
+
+/*********************************************************************
+* Function: bool ADC_Start(ADC_CHANNEL channel);
+*
+* Overview: Starts a single conversion and returns straight away, so the
+*           caller can do other work until ADC_IsReady() returns true.
+*
+* PreCondition: A single conversion configuration set and channel enabled via
+*               ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to convert
+*
+* Output: bool - true if started, false if a conversion is in progress,
+*         the ADC is scanning or the channel is not valid.
+*
+********************************************************************/
+bool ADC_Start(ADC_CHANNEL channel);
+
+/*********************************************************************
+* Function: bool ADC_StartWithCallback(ADC_CHANNEL channel,
+*                                      ADC_CALLBACK callback,
+*                                      void *context);
+*
+* Overview: Starts a single conversion and calls back from the ADC
+*           interrupt with the result.  The callback may start the next
+*           conversion.
+*
+* PreCondition: A single conversion configuration set and channel enabled via
+*               ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to convert
+*        ADC_CALLBACK callback - called with the result, may be NULL
+*        void *context - passed to the callback
+*
+* Output: bool - true if started, false if a conversion is in progress,
+*         the ADC is scanning or the channel is not valid.
+*
+********************************************************************/
+bool ADC_StartWithCallback(ADC_CHANNEL channel, ADC_CALLBACK callback, void *context);
+
+/*********************************************************************
+* Function: bool ADC_IsReady(void);
+*
+* Overview: Tells whether the conversion started last has completed.
+*
+* PreCondition: ADC_Start() called
+*
+* Input: None
+*
+* Output: bool - true if the result is available
+*
+********************************************************************/
+bool ADC_IsReady(void);
+
+/*********************************************************************
+* Function: uint16_t ADC_GetResult(void);
+*
+* Overview: Returns the result of the conversion started last.  It stays
+*           available until the next conversion is started.
+*
+* PreCondition: ADC_IsReady() returned true
+*
+* Input: None
+*
+* Output: uint16_t the right adjusted result, see ADC_GetResolution(),
+*         or 0xFFFF if the conversion has not completed.
+*
+********************************************************************/
+uint16_t ADC_GetResult(void);
+
+/*********************************************************************
+* Function: uint16_t ADC_ReadLatest(ADC_CHANNEL channel);
+*
+* Overview: Returns the newest sample of a channel stored by the scan
+*           interrupt, without waiting.
+*
+* PreCondition: ADC_CONFIGURATION_SCAN set and channel enabled via
+*               ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to read
+*
+* Output: uint16_t the right adjusted 10-bit sample, or 0xFFFF if no
+*         scan has completed yet or for an error.
+*
+********************************************************************/
+uint16_t ADC_ReadLatest(ADC_CHANNEL channel);
+
+/*********************************************************************
+* Function: bool ADC_CaptureBurst(ADC_CHANNEL channel,
+*                                 uint16_t *buffer,
+*                                 uint16_t count,
+*                                 uint32_t rate);
+*
+* Overview: Records count samples of one channel, evenly spaced by
+*           Timer1, into a buffer and returns straight away.  The ADC
+*           interrupt stores each sample, at the resolution of the
+*           current configuration (oversampling is not used).  The ADC
+*           is held by the capture: other reads fail until
+*           ADC_SetConfiguration() is called again.
+*
+* PreCondition: channel enabled via ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to capture
+*        uint16_t *buffer - where to store the samples, left untouched by
+*        the caller until the capture completes
+*        uint16_t count - samples to capture
+*        uint32_t rate - samples per second
+*
+* Output: bool - true if the capture started, false if a capture is
+*         running or an argument is not valid.  The configuration is
+*         left alone when false is returned.
+*
+********************************************************************/
+bool ADC_CaptureBurst(ADC_CHANNEL channel, uint16_t *buffer, uint16_t count, uint32_t rate);
+
+/*********************************************************************
+* Function: bool ADC_CaptureBurstWithCallback(ADC_CHANNEL channel,
+*                                             uint16_t *buffer,
+*                                             uint16_t count,
+*                                             uint32_t rate,
+*                                             ADC_CAPTURE_CALLBACK callback,
+*                                             void *context);
+*
+* Overview: Records a burst as ADC_CaptureBurst() does and calls back
+*           from the ADC interrupt once the last sample is stored, so
+*           the caller does not have to poll ADC_IsCaptureComplete().
+*
+* PreCondition: channel enabled via ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to capture
+*        uint16_t *buffer - where to store the samples, left untouched by
+*        the caller until the capture completes
+*        uint16_t count - samples to capture
+*        uint32_t rate - samples per second
+*        ADC_CAPTURE_CALLBACK callback - called on completion, may be NULL
+*        void *context - passed to the callback
+*
+* Output: bool - true if the capture started, false if a capture is
+*         running or an argument is not valid.
+*
+********************************************************************/
+bool ADC_CaptureBurstWithCallback(ADC_CHANNEL channel, uint16_t *buffer, uint16_t count, uint32_t rate, ADC_CAPTURE_CALLBACK callback, void *context);
+
+/*********************************************************************
+* Function: bool ADC_IsCaptureComplete(void);
+*
+* Overview: Tells whether the burst started by ADC_CaptureBurst() has
+*           been captured.
+*
+* PreCondition: ADC_CaptureBurst() called
+*
+* Input: None
+*
+* Output: bool - true once the last sample is stored
+*
+********************************************************************/
+bool ADC_IsCaptureComplete(void);
+
+/*********************************************************************
+* Function: bool ADC_ExportBurst(const uint16_t *buffer,
+*                                uint16_t count,
+*                                ADC_EXPORT_PUTC put);
+*
+* Overview: Streams samples out in binary, e.g. over UART2 with
+*           ADC_ExportBurst(buffer, count, &putU2).  The frame is 0xA5
+*           0x5A, the count (2 bytes), the resolution in bits (1 byte),
+*           the samples (2 bytes each) and the 16-bit sum of the samples
+*           (2 bytes), all little endian.  The buffer of the last burst
+*           is labelled with the resolution it was captured at.
+*
+* PreCondition: the capture into buffer, if any, has completed
+*
+* Input: const uint16_t *buffer - the samples
+*        uint16_t count - number of samples
+*        ADC_EXPORT_PUTC put - writes one byte
+*
+* Output: bool - true if the whole frame was written, false if a capture
+*         into buffer is still running or put() returned -1, in which
+*         case the rest of the frame is not sent.
+*
+********************************************************************/
+bool ADC_ExportBurst(const uint16_t *buffer, uint16_t count, ADC_EXPORT_PUTC put);
+
+#if defined(ADC_ENABLE_STATISTICS)
+/*********************************************************************
+* Function: bool ADC_GetStatistics(ADC_CHANNEL channel,
+*                                  ADC_STATISTICS *statistics);
+*
+* Overview: Reads the minimum, maximum, mean and variance of the samples
+*           of a channel since ADC_ResetStatistics().  They are kept by
+*           the ADC interrupt in constant memory (Welford's method), from
+*           the samples before filtering, so the variance shows the
+*           noise.  The window stops growing at 65535 samples.
+*
+* PreCondition: None
+*
+* Input: ADC_CHANNEL channel - the channel
+*        ADC_STATISTICS *statistics - where to store the figures
+*
+* Output: bool - true if the channel has samples, false otherwise
+*
+********************************************************************/
+bool ADC_GetStatistics(ADC_CHANNEL channel, ADC_STATISTICS *statistics);
+
+/*********************************************************************
+* Function: void ADC_ResetStatistics(ADC_CHANNEL channel);
+*
+* Overview: Starts a new statistics window for a channel.
+*
+* PreCondition: None
+*
+* Input: ADC_CHANNEL channel - the channel
+*
+* Output: None
+*
+********************************************************************/
+void ADC_ResetStatistics(ADC_CHANNEL channel);
+#endif
+
+/*********************************************************************
+* Function: bool ADC_SetFilter(ADC_CHANNEL channel,
+*                              ADC_FILTER_TYPE type,
+*                              uint16_t parameter);
+*
+* Overview: Selects the filter the ADC interrupt applies to the samples
+*           of a channel, in every configuration.  The filter restarts
+*           from the next sample, so there is no settling from zero.
+*
+* PreCondition: none
+*
+* Input: ADC_CHANNEL channel - the channel to filter
+*        ADC_FILTER_TYPE type - the filter
+*        uint16_t parameter - taps or coefficient, see ADC_FILTER_TYPE,
+*        ignored for ADC_FILTER_NONE
+*
+* Output: bool - true if set, false if the channel or parameter is not
+*         valid.
+*
+********************************************************************/
+bool ADC_SetFilter(ADC_CHANNEL channel, ADC_FILTER_TYPE type, uint16_t parameter);
+
+/*********************************************************************
+* Function: uint16_t ADC_ReadFiltered(ADC_CHANNEL channel);
+*
+* Overview: Returns the filter output for the newest sample of a
+*           channel, without waiting.
+*
+* PreCondition: ADC_SetFilter() called for the channel
+*
+* Input: ADC_CHANNEL channel - the channel to read
+*
+* Output: uint16_t the filtered value at the resolution of the samples,
+*         or 0xFFFF if the channel has no sample yet or for an error.
+*
+********************************************************************/
+uint16_t ADC_ReadFiltered(ADC_CHANNEL channel);
+
+/*********************************************************************
+* Function: bool ADC_SetThreshold(ADC_CHANNEL channel,
+*                                 uint16_t low,
+*                                 uint16_t high,
+*                                 ADC_THRESHOLD_CALLBACK callback);
+*
+* Overview: Watches the filtered value of a channel against a window and
+*           calls back from the ADC interrupt only when it crosses into
+*           another zone, so the application can idle instead of polling.
+*           A zone is left only once the value is ADC_THRESHOLD_HYSTERESIS
+*           past its edge.  The first sample after the call reports the
+*           starting zone.  Use low == high for a single threshold.
+*
+* PreCondition: none
+*
+* Input: ADC_CHANNEL channel - the channel to watch
+*        uint16_t low - values below are ADC_ZONE_BELOW
+*        uint16_t high - values above are ADC_ZONE_ABOVE
+*        ADC_THRESHOLD_CALLBACK callback - called on crossings, NULL to
+*        stop watching
+*
+* Output: bool - true if set, false if the channel is not valid or low
+*         is above high.
+*
+********************************************************************/
+bool ADC_SetThreshold(ADC_CHANNEL channel, uint16_t low, uint16_t high, ADC_THRESHOLD_CALLBACK callback);
+
+/*********************************************************************
+* Function: int16_t ADC_ToTemperature(uint16_t counts);
+*
+* Overview: Converts a result of ADC_CHANNEL_TEMPERATURE_SENSOR to
+*           temperature with a table built at compile time for the
+*           board's sensor and reference, interpolated between entries.
+*           No division is done at run time.  The board calibration
+*           offset, if programmed, is added.
+*
+* PreCondition: ADC_SetConfiguration() called, so the resolution of the
+*               counts is known
+*
+* Input: uint16_t counts - a result of ADC_Read(), ADC_GetResult(),
+*        ADC_ReadLatest() or ADC_ReadFiltered()
+*
+* Output: int16_t - temperature in hundredths of a degree Celsius, or
+*         ADC_TEMPERATURE_INVALID if counts is 0xFFFF.
+*
+********************************************************************/
+int16_t ADC_ToTemperature(uint16_t counts);
+
+/*********************************************************************
+* Function: uint16_t ADC_GetScanCount(void);
+*
+* Overview: Returns the number of scans completed since the scan was
+*           configured.  A change tells that new samples are stored.
+*
+* PreCondition: ADC_CONFIGURATION_SCAN set
+*
+* Input: None
+*
+* Output: uint16_t - completed scans, wrapping at 0xFFFF
+*
+********************************************************************/
+uint16_t ADC_GetScanCount(void);
+
 /*********************************************************************
 * Function: bool ADC_ChannelEnable(ADC_CHANNEL channel, ADC_CONFIGURATION configuration);
 *
@@ -104,4 +538,21 @@ bool ADC_ChannelEnable(ADC_CHANNEL channel);
 ********************************************************************/
 bool ADC_SetConfiguration(ADC_CONFIGURATION configuration);
 
+/*********************************************************************
+* Function: bool ADC_SetSampleRate(uint32_t hz);
+*
+* Overview: Sets the rate at which each enabled channel is sampled in
+*           ADC_CONFIGURATION_TIMED.  Timer1 triggers conversions at hz
+*           times the number of enabled channels.  May be called before
+*           or after the configuration is set.
+*
+* PreCondition: none
+*
+* Input: uint32_t hz - samples per second per channel
+*
+* Output: bool - true if the rate can be produced, false otherwise.
+*
+********************************************************************/
+bool ADC_SetSampleRate(uint32_t hz);
+
 #endif  //ADC_H
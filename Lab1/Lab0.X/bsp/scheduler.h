@@ -0,0 +1,113 @@
+/*
+ * File:   scheduler.h
+ *
+ * Run-to-completion cooperative scheduler on top of timer_1ms.  Each task
+ * owns one priority level; ready tasks run one at a time, lowest priority
+ * number first, and the core sits in Idle while nothing is ready.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer_1ms.h"
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/* Number of priority levels, and so of tasks.  At most 255. */
+#ifndef SCHEDULER_MAX_TASKS
+    #define SCHEDULER_MAX_TASKS 8
+#endif
+
+/* Length of the window over which SCHEDULER_GetUtilization() is measured. */
+#ifndef SCHEDULER_UTILIZATION_WINDOW_MS
+    #define SCHEDULER_UTILIZATION_WINDOW_MS 1000
+#endif
+
+typedef void (*SCHEDULER_TASK)(void);
+
+/* Identifies a task.  0 is the most urgent. */
+typedef uint8_t SCHEDULER_PRIORITY;
+
+/*********************************************************************
+* Function: bool SCHEDULER_TaskCreate(SCHEDULER_PRIORITY priority,
+*                                     SCHEDULER_TASK task)
+*
+* Overview: Installs a task at a priority level.  The task runs once for
+*           every time it is posted, and must return without blocking.
+*
+* PreCondition: None
+*
+* Input:  priority - 0 to SCHEDULER_MAX_TASKS - 1, not already in use
+*         task - the function to run
+*
+* Output: bool - true if successful, false if unsuccessful
+*
+********************************************************************/
+bool SCHEDULER_TaskCreate(SCHEDULER_PRIORITY priority, SCHEDULER_TASK task);
+
+/*********************************************************************
+* Function: bool SCHEDULER_Post(SCHEDULER_PRIORITY priority)
+*
+* Overview: Makes a task ready.  Safe to call from interrupts.  Posts
+*           made before the task gets to run are merged into one run.
+*
+* PreCondition: None
+*
+* Input:  priority - the task to run
+*
+* Output: bool - true if successful, false if there is no such task
+*
+********************************************************************/
+bool SCHEDULER_Post(SCHEDULER_PRIORITY priority);
+
+/*********************************************************************
+* Function: TIMER_HANDLE SCHEDULER_PostEvery(SCHEDULER_PRIORITY priority,
+*                                            uint32_t rate)
+*
+* Overview: Posts a task periodically from the timer interrupt.
+*
+* PreCondition: TIMER_SetConfiguration() called, from main context or at
+*               the timer interrupt priority as for TIMER_Schedule()
+*
+* Input:  priority - the task to run
+*         rate - the number of ticks between posts
+*
+* Output: TIMER_HANDLE - handle for TIMER_Cancel(), or TIMER_HANDLE_INVALID
+*
+********************************************************************/
+TIMER_HANDLE SCHEDULER_PostEvery(SCHEDULER_PRIORITY priority, uint32_t rate);
+
+/*********************************************************************
+* Function: void SCHEDULER_Run(void)
+*
+* Overview: Runs ready tasks and deferred timer handlers forever.  When
+*           neither is waiting the core is put in Idle until the next
+*           interrupt.
+*
+* PreCondition: Tasks created
+*
+* Input:  None
+*
+* Output: Does not return
+*
+********************************************************************/
+void SCHEDULER_Run(void);
+
+/*********************************************************************
+* Function: uint8_t SCHEDULER_GetUtilization(void)
+*
+* Overview: Reads the share of time the core was awake, running tasks
+*           or interrupts, over the last complete window of
+*           SCHEDULER_UTILIZATION_WINDOW_MS.
+*
+* PreCondition: SCHEDULER_Run() running
+*
+* Input:  None
+*
+* Output: uint8_t - CPU utilisation in percent
+*
+********************************************************************/
+uint8_t SCHEDULER_GetUtilization(void);
+
+#endif //SCHEDULER_H
@@ -16,8 +16,12 @@
 #include "bsp/timer_1ms.h"
 #include "bsp/buttons.h"
 #include "bsp/leds.h"
+#include "bsp/scheduler.h"
+
+#define TASK_BUTTON 0
 
 static void TimerEventHandler( void );
+static void ButtonTask( void );
 
 
 int main(void) {
@@ -30,18 +34,23 @@ int main(void) {
     TIMER_SetConfiguration ( TIMER_CONFIGURATION_1MS );
     TIMER_RequestTick( &TimerEventHandler, 1000 );
     
-    while(1){
-     
-        if(BUTTON_IsPressed( BUTTON_S3 ) == true)
-        {
-            LED_On( LED_D3 );
-        }
-        else
-        {
-            LED_Off( LED_D3 );
-        }
+    /* Follow the button every 10ms and idle in between. */
+    SCHEDULER_TaskCreate( TASK_BUTTON, &ButtonTask );
+    SCHEDULER_PostEvery( TASK_BUTTON, 10 );
+    
+    SCHEDULER_Run();
+}
+
+static void ButtonTask(void)
+{
+    if(BUTTON_IsPressed( BUTTON_S3 ) == true)
+    {
+        LED_On( LED_D3 );
+    }
+    else
+    {
+        LED_Off( LED_D3 );
     }
-        
 }
 
 static void TimerEventHandler(void)
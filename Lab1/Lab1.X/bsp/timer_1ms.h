@@ -23,14 +23,65 @@ limitations under the License.
 #ifndef TIMER_1MS
 #define TIMER_1MS
 
-#define TIMER_TICK_INTERVAL_MICRO_SECONDS 1000
-
 /* Type Definitions ***********************************************/
 typedef void (*TICK_HANDLER)(void);
 
+typedef void (*TIMER_CALLBACK)(void *context);
+
+/* Identifies a request made with TIMER_Schedule(). */
+typedef uint16_t TIMER_HANDLE;
+
+#define TIMER_HANDLE_INVALID 0
+
+typedef enum
+{
+    TIMER_FLAG_NONE = 0x00,
+    /* Run the handler from TIMER_Dispatch() instead of the timer ISR. */
+    TIMER_FLAG_DEFERRED = 0x01,
+    /* Call the handler once and then free the request. */
+    TIMER_FLAG_ONE_SHOT = 0x02,
+    /* Overrun policy of a periodic request, used when deadlines are
+     * missed because the timer interrupt or TIMER_Dispatch() ran late.
+     * By default every deadline still gets its call (catch up).  SKIP
+     * drops the missed calls and COALESCE folds them into one call.
+     * The deadlines stay on the original grid either way. */
+    TIMER_FLAG_OVERRUN_SKIP = 0x04,
+    TIMER_FLAG_OVERRUN_COALESCE = 0x08
+} TIMER_FLAGS;
+
+#if defined(TIMER_ENABLE_STATS)
+/* Per client figures collected when TIMER_ENABLE_STATS is defined for the
+ * whole project.  Times are in Fcy cycles, see TIMER_GetTicks(). */
+typedef struct
+{
+    TICK_HANDLER handle;
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint32_t average_cycles;
+    /* Longest delay between the tick the request was due on and the
+     * handler starting, including time spent in the deferred queue. */
+    uint32_t max_lateness_cycles;
+    /* Deadlines that were not serviced on time, see TIMER_GetMissed(). */
+    uint32_t missed;
+} TIMER_STATS;
+#endif
+
+/* Request rates are counted in ticks of the configured length.  The Timer3
+ * setting for each rate is chosen at compile time; the build fails if it is
+ * further than TIMER_TICK_TOLERANCE_PPM (default 100) from the rate. */
 typedef enum
 {
     TIMER_CONFIGURATION_1MS,
+    TIMER_CONFIGURATION_250US,
+    TIMER_CONFIGURATION_100US,
+#if defined(TIMER_CUSTOM_TICK_HZ)
+    /* Ticks at TIMER_CUSTOM_TICK_HZ, defined for the whole project. */
+    TIMER_CONFIGURATION_CUSTOM,
+#endif
+    /* 1ms ticks, but Timer3 only interrupts when a request is due (or at
+     * least every TIMER_WHEEL_SIZE ticks) and keeps running in Idle. */
+    TIMER_CONFIGURATION_TICKLESS,
     TIMER_CONFIGURATION_OFF
 } TIMER_CONFIGURATIONS;
 
@@ -39,7 +90,8 @@ typedef enum
 *
 * Overview: Cancels a tick request.
 *
-* PreCondition: None
+* PreCondition: Called from main context or at the timer interrupt
+*               priority, see TIMER_Schedule()
 *
 * Input:  handle - the function that was handling the tick request
 *
@@ -53,7 +105,8 @@ void TIMER_CancelTick(TICK_HANDLER handle);
 *
 * Overview: Requests to receive a periodic event.
 *
-* PreCondition: None
+* PreCondition: Called from main context or at the timer interrupt
+*               priority, see TIMER_Schedule()
 *
 * Input:  handle - the function that will be called when the time event occurs
 *         rate - the number of ticks per event.
@@ -63,6 +116,120 @@ void TIMER_CancelTick(TICK_HANDLER handle);
 ********************************************************************/
 bool TIMER_RequestTick(TICK_HANDLER handle, uint32_t rate);
 
+/*********************************************************************
+* Function: bool TIMER_RequestTickWithFlags(TICK_HANDLER handle,
+*                                           uint32_t rate,
+*                                           TIMER_FLAGS flags)
+*
+* Overview: Requests to receive a periodic event, choosing the context
+*           the handler runs in.  Deferred handlers are only queued by
+*           the timer ISR and run on the next call to TIMER_Dispatch(),
+*           so they may block without delaying other interrupts.
+*
+* PreCondition: Called from main context or at the timer interrupt
+*               priority, see TIMER_Schedule()
+*
+* Input:  handle - the function that will be called when the time event occurs
+*         rate - the number of ticks per event.
+*         flags - TIMER_FLAG_DEFERRED to run the handler from TIMER_Dispatch()
+*
+* Output: bool - true if successful, false if unsuccessful
+*
+********************************************************************/
+bool TIMER_RequestTickWithFlags(TICK_HANDLER handle, uint32_t rate, TIMER_FLAGS flags);
+
+/*********************************************************************
+* Function: TIMER_HANDLE TIMER_Schedule(TIMER_CALLBACK callback,
+*                                       void *context,
+*                                       uint32_t rate,
+*                                       TIMER_FLAGS flags)
+*
+* Overview: Requests a periodic or one-shot event.  The context pointer
+*           is passed to the callback, so one function can serve several
+*           driver instances.  A one-shot callback may schedule itself
+*           again.  Requests and cancels from main context are handed to
+*           the timer interrupt through a queue and never disable it.
+*
+* PreCondition: Called from main context (IPL 0) or at the timer interrupt
+*               priority, as from a handler.  Calls from interrupts at any
+*               other priority return TIMER_HANDLE_INVALID.
+*
+* Input:  callback - the function that will be called when the time event occurs
+*         context - passed to the callback
+*         rate - the number of ticks until (and, if periodic, between) events,
+*                at least 1
+*         flags - TIMER_FLAG_ONE_SHOT and/or TIMER_FLAG_DEFERRED
+*
+* Output: TIMER_HANDLE - handle for TIMER_Cancel(), or TIMER_HANDLE_INVALID
+*
+********************************************************************/
+TIMER_HANDLE TIMER_Schedule(TIMER_CALLBACK callback, void *context, uint32_t rate, TIMER_FLAGS flags);
+
+/*********************************************************************
+* Function: bool TIMER_Cancel(TIMER_HANDLE handle)
+*
+* Overview: Cancels a request made with TIMER_Schedule() in constant
+*           time.  Handles of completed or cancelled requests are
+*           recognised and ignored, even if the slot has been reused.
+*
+* PreCondition: Called from main context (IPL 0) or at the timer interrupt
+*               priority, as from a handler.  Calls from interrupts at any
+*               other priority return false.
+*
+* Input:  handle - the request to cancel
+*
+* Output: bool - true if the request was still pending, false otherwise
+*
+********************************************************************/
+bool TIMER_Cancel(TIMER_HANDLE handle);
+
+/*********************************************************************
+* Function: uint32_t TIMER_GetMissed(TIMER_HANDLE handle)
+*
+* Overview: Reads the number of deadlines of a request that were not
+*           serviced on time.  Depending on the overrun policy these
+*           were called late, folded into another call or dropped.
+*
+* PreCondition: None
+*
+* Input:  handle - the request, as returned by TIMER_Schedule()
+*
+* Output: uint32_t - missed deadlines, 0 if the handle is not valid
+*
+********************************************************************/
+uint32_t TIMER_GetMissed(TIMER_HANDLE handle);
+
+/*********************************************************************
+* Function: void TIMER_Dispatch(void)
+*
+* Overview: Runs the deferred handlers that have become due.  Call it
+*           from the main loop.
+*
+* PreCondition: Called from main context (IPL 0), otherwise it does nothing
+*
+* Input:  None
+*
+* Output: None
+*
+********************************************************************/
+void TIMER_Dispatch(void);
+
+/*********************************************************************
+* Function: bool TIMER_IsDispatchPending(void)
+*
+* Overview: Tells whether deferred handlers are waiting for
+*           TIMER_Dispatch(), so that a main loop can decide whether it
+*           may go to Idle.
+*
+* PreCondition: None
+*
+* Input:  None
+*
+* Output: bool - true if TIMER_Dispatch() has work to do
+*
+********************************************************************/
+bool TIMER_IsDispatchPending(void);
+
 /*********************************************************************
 * Function: bool TIMER_SetConfiguration(TIMER_CONFIGURATIONS configuration)
 *
@@ -77,4 +244,73 @@ bool TIMER_RequestTick(TICK_HANDLER handle, uint32_t rate);
 ********************************************************************/
 bool TIMER_SetConfiguration(TIMER_CONFIGURATIONS configuration);
 
+/*********************************************************************
+* Function: uint32_t TIMER_GetTicks(void)
+*
+* Overview: Reads the free running 32-bit timestamp counter (Timer4/Timer5
+*           cascaded).  It counts peripheral clock cycles and is safe to
+*           call from main and interrupt context.  Only a few instructions,
+*           so it can bracket driver calls for profiling.
+*
+* PreCondition: Timer configured via TIMER_SetConfiguration()
+*
+* Input:  None
+*
+* Output: uint32_t - Fcy cycles, wrapping at 2^32
+*
+********************************************************************/
+uint32_t TIMER_GetTicks(void);
+
+/*********************************************************************
+* Function: uint32_t TIMER_GetMicros(void)
+*
+* Overview: Reads the free running timestamp in microseconds.  Safe to
+*           call from main and interrupt context.
+*
+* PreCondition: Timer configured via TIMER_SetConfiguration()
+*
+* Input:  None
+*
+* Output: uint32_t - microseconds, wrapping at 2^32
+*
+********************************************************************/
+uint32_t TIMER_GetMicros(void);
+
+/*********************************************************************
+* Function: uint32_t TIMER_GetTickMicros(void)
+*
+* Overview: Reads the length of one tick of the running configuration,
+*           the unit of the rate passed to TIMER_Schedule().
+*
+* PreCondition: None
+*
+* Input:  None
+*
+* Output: uint32_t - microseconds per tick, rounded to nearest, or 0 if
+*         the timer is not configured
+*
+********************************************************************/
+uint32_t TIMER_GetTickMicros(void);
+
+#if defined(TIMER_ENABLE_STATS)
+/*********************************************************************
+* Function: bool TIMER_GetStats(uint8_t index, TIMER_STATS *stats)
+*
+* Overview: Reads the execution statistics of one client slot.  Iterate
+*           index over 0 to TIMER_MAX_1MS_CLIENTS - 1 to find which
+*           handler uses the most of the interrupt budget.  Statistics
+*           restart when a slot is reused.
+*
+* PreCondition: Called from main context (IPL 0)
+*
+* Input:  index - client slot
+*         stats - where to store the statistics
+*
+* Output: bool - true if the slot holds a request, false otherwise or if
+*         not called from main context
+*
+********************************************************************/
+bool TIMER_GetStats(uint8_t index, TIMER_STATS *stats);
+#endif
+
 #endif //TIMER_1MS
@@ -18,10 +18,14 @@
 #include "bsp/timer_1ms.h"
 #include "bsp/buttons.h"
 #include "bsp/leds.h"
+#include "bsp/scheduler.h"
+
+#define TASK_LEDS 0
 
 static void TimerEventHandler( void );
 static void ButtonDebounce( void );
-unsigned char cnt = 0;
+static void LedsTask( void );
+volatile unsigned char cnt = 0;
 
 int main(void) {
     LED_Enable_all();
@@ -32,13 +36,20 @@ int main(void) {
     TIMER_RequestTick( &TimerEventHandler, 1000 );
     TIMER_RequestTick( &ButtonDebounce, 1 );
     
-    while(1){
+    /* The LEDs only change when the count does, so update them from a
+     * task posted by the debounce handler. */
+    SCHEDULER_TaskCreate( TASK_LEDS, &LedsTask );
+    SCHEDULER_Post( TASK_LEDS );
+    
+    SCHEDULER_Run();
+}
 
-        if ( cnt == 128 ){
-            cnt = 0;
-        }
-        LEDS_Set(cnt);   
-    }  
+static void LedsTask(void)
+{
+    if ( cnt >= 128 ){
+        cnt = 0;
+    }
+    LEDS_Set(cnt);
 }
 
 static void TimerEventHandler(void)
@@ -56,6 +67,7 @@ static void ButtonDebounce(void)
         {
             LED_Toggle( LED_D9 );
             cnt++;
+            SCHEDULER_Post( TASK_LEDS );
         }
         debounceCounterS3 = BUTTON_DEBOUCE_TIME_MS;
     } else{
@@ -0,0 +1,258 @@
+/*
+ * File:   scheduler.c
+ *
+ * Run-to-completion cooperative scheduler on top of timer_1ms.
+ */
+
+#include <xc.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "scheduler.h"
+#include "timer_1ms.h"
+
+#ifndef SYSTEM_PERIPHERAL_CLOCK
+#define SYSTEM_PERIPHERAL_CLOCK 16000000
+#pragma message "This module requires a definition for the peripheral clock frequency.  Assuming 16MHz Fcy (32MHz Fosc).  Define value if this is not correct."
+#endif
+
+/* Compiler checks and configuration *******************************/
+#if (SCHEDULER_MAX_TASKS > 255)
+    #error "SCHEDULER_MAX_TASKS must be at most 255."
+#endif
+
+/* Definitions *****************************************************/
+#define SCHEDULER_WINDOW_CYCLES ((uint32_t)(SYSTEM_PERIPHERAL_CLOCK / 1000) * SCHEDULER_UTILIZATION_WINDOW_MS)
+
+/* Highest CPU priority, held while deciding to go to Idle. */
+#define SCHEDULER_IPL_ALL_MASKED 7
+
+/* Type Definitions ************************************************/
+typedef struct
+{
+    SCHEDULER_TASK task;
+    /* Set from any context, cleared by SCHEDULER_Run().  A byte write
+     * is atomic, so posting needs no masking. */
+    volatile bool ready;
+} SCHEDULER_TASK_ENTRY;
+
+/* Variables *******************************************************/
+static SCHEDULER_TASK_ENTRY tasks[SCHEDULER_MAX_TASKS];
+static volatile uint8_t utilization;
+
+/* Private Functions ***********************************************/
+static void SCHEDULER_TimerPost(void *context);
+static bool SCHEDULER_IsReady(void);
+
+/*********************************************************************
+ * Function: bool SCHEDULER_TaskCreate(SCHEDULER_PRIORITY priority,
+ *                                     SCHEDULER_TASK task)
+ *
+ * Overview: Installs a task at a priority level.
+ *
+ * PreCondition: None
+ *
+ * Input:  priority - 0 to SCHEDULER_MAX_TASKS - 1, not already in use
+ *         task - the function to run
+ *
+ * Output: bool - true if successful, false if unsuccessful
+ *
+ ********************************************************************/
+bool SCHEDULER_TaskCreate(SCHEDULER_PRIORITY priority, SCHEDULER_TASK task)
+{
+    if((priority >= SCHEDULER_MAX_TASKS) || (task == NULL) || (tasks[priority].task != NULL))
+    {
+        return false;
+    }
+
+    tasks[priority].ready = false;
+    tasks[priority].task = task;
+
+    return true;
+}
+
+/*********************************************************************
+ * Function: bool SCHEDULER_Post(SCHEDULER_PRIORITY priority)
+ *
+ * Overview: Makes a task ready.
+ *
+ * PreCondition: None
+ *
+ * Input:  priority - the task to run
+ *
+ * Output: bool - true if successful, false if there is no such task
+ *
+ ********************************************************************/
+bool SCHEDULER_Post(SCHEDULER_PRIORITY priority)
+{
+    if((priority >= SCHEDULER_MAX_TASKS) || (tasks[priority].task == NULL))
+    {
+        return false;
+    }
+
+    tasks[priority].ready = true;
+
+    return true;
+}
+
+/*********************************************************************
+ * Function: TIMER_HANDLE SCHEDULER_PostEvery(SCHEDULER_PRIORITY priority,
+ *                                            uint32_t rate)
+ *
+ * Overview: Posts a task periodically from the timer interrupt.
+ *
+ * PreCondition: TIMER_SetConfiguration() called, from main context or at
+ *               the timer interrupt priority as for TIMER_Schedule()
+ *
+ * Input:  priority - the task to run
+ *         rate - the number of ticks between posts
+ *
+ * Output: TIMER_HANDLE - handle for TIMER_Cancel(), or TIMER_HANDLE_INVALID
+ *
+ ********************************************************************/
+TIMER_HANDLE SCHEDULER_PostEvery(SCHEDULER_PRIORITY priority, uint32_t rate)
+{
+    if((priority >= SCHEDULER_MAX_TASKS) || (tasks[priority].task == NULL))
+    {
+        return TIMER_HANDLE_INVALID;
+    }
+
+    /* Posting only sets a flag, so it runs straight from the timer ISR
+     * and the task itself runs from SCHEDULER_Run(). */
+    return TIMER_Schedule(&SCHEDULER_TimerPost, &tasks[priority], rate, TIMER_FLAG_NONE);
+}
+
+/*********************************************************************
+ * Function: void SCHEDULER_Run(void)
+ *
+ * Overview: Runs the most urgent ready task, then looks again, so a task
+ *           posted while another runs waits at most for that one to
+ *           finish.  Idle time is measured on the timestamp counter.
+ *
+ * PreCondition: Tasks created
+ *
+ * Input:  None
+ *
+ * Output: Does not return
+ *
+ ********************************************************************/
+void SCHEDULER_Run(void)
+{
+    uint8_t i;
+    int ipl;
+    uint32_t window_start = TIMER_GetTicks();
+    uint32_t idle_cycles = 0;
+    uint32_t sleep_start;
+    uint32_t elapsed;
+
+    while(1)
+    {
+        TIMER_Dispatch();
+
+        for(i = 0; i < SCHEDULER_MAX_TASKS; i++)
+        {
+            if(tasks[i].ready == true)
+            {
+                tasks[i].ready = false;
+                tasks[i].task();
+                break;
+            }
+        }
+
+        if(i == SCHEDULER_MAX_TASKS)
+        {
+            /* With the CPU priority raised no interrupt can make work
+             * ready between the check and Idle.  An enabled interrupt
+             * still wakes the core and is taken once the priority is
+             * restored. */
+            SET_AND_SAVE_CPU_IPL(ipl, SCHEDULER_IPL_ALL_MASKED);
+
+            if((SCHEDULER_IsReady() == false) && (TIMER_IsDispatchPending() == false))
+            {
+                sleep_start = TIMER_GetTicks();
+                Idle();
+                idle_cycles += TIMER_GetTicks() - sleep_start;
+            }
+
+            RESTORE_CPU_IPL(ipl);
+        }
+
+        elapsed = TIMER_GetTicks() - window_start;
+
+        if(elapsed >= SCHEDULER_WINDOW_CYCLES)
+        {
+            if(idle_cycles > elapsed)
+            {
+                idle_cycles = elapsed;
+            }
+
+            utilization = (uint8_t)(((uint64_t)(elapsed - idle_cycles) * 100) / elapsed);
+
+            window_start += elapsed;
+            idle_cycles = 0;
+        }
+    }
+}
+
+/*********************************************************************
+ * Function: uint8_t SCHEDULER_GetUtilization(void)
+ *
+ * Overview: Reads the CPU utilisation of the last complete window.
+ *
+ * PreCondition: SCHEDULER_Run() running
+ *
+ * Input:  None
+ *
+ * Output: uint8_t - CPU utilisation in percent
+ *
+ ********************************************************************/
+uint8_t SCHEDULER_GetUtilization(void)
+{
+    return utilization;
+}
+
+/*********************************************************************
+ * Function: static void SCHEDULER_TimerPost(void *context)
+ *
+ * Overview: Timer callback of SCHEDULER_PostEvery().
+ *
+ * PreCondition: None
+ *
+ * Input:  context - the task entry to make ready
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void SCHEDULER_TimerPost(void *context)
+{
+    ((SCHEDULER_TASK_ENTRY *)context)->ready = true;
+}
+
+/*********************************************************************
+ * Function: static bool SCHEDULER_IsReady(void)
+ *
+ * Overview: Tells whether any task is ready.
+ *
+ * PreCondition: None
+ *
+ * Input:  None
+ *
+ * Output: bool - true if a task is waiting to run
+ *
+ ********************************************************************/
+static bool SCHEDULER_IsReady(void)
+{
+    uint8_t i;
+
+    for(i = 0; i < SCHEDULER_MAX_TASKS; i++)
+    {
+        if(tasks[i].ready == true)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
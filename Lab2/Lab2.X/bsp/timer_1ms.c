@@ -28,36 +28,119 @@ limitations under the License.
 #pragma message "This module requires a definition for the peripheral clock frequency.  Assuming 16MHz Fcy (32MHz Fosc).  Define value if this is not correct."
 #endif
 
-#define CLOCK_DIVIDER TIMER_PRESCALER_1
-#define PR3_SETTING (SYSTEM_PERIPHERAL_CLOCK/1000/1)
+/* Tick period solver.  For a tick rate in Hz, TICK_PRESCALE() picks the
+ * Timer3 prescaler whose rounded period comes closest to the rate, taking
+ * the smaller prescaler on a tie, and TICK_COUNTS() gives that period in
+ * timer counts.  Periods outside 2 to 0x10000 counts cannot be loaded into
+ * PR3.  Everything folds to constants, so the expressions can also be
+ * used in #if. */
+#define TICK_COUNTS(hz, p)          ((SYSTEM_PERIPHERAL_CLOCK + (((p) * (hz) * 1ul) / 2)) / ((p) * (hz) * 1ul))
+#define TICK_VALID(hz, p)           ((TICK_COUNTS(hz, p) >= 2) && (TICK_COUNTS(hz, p) <= 0x10000))
+#define TICK_ERROR_CYCLES(hz, p)    (((TICK_COUNTS(hz, p) * (p) * (hz)) > SYSTEM_PERIPHERAL_CLOCK) ? \
+                                     ((TICK_COUNTS(hz, p) * (p) * (hz)) - SYSTEM_PERIPHERAL_CLOCK) : \
+                                     (SYSTEM_PERIPHERAL_CLOCK - (TICK_COUNTS(hz, p) * (p) * (hz))))
+#define TICK_COST(hz, p)            (TICK_VALID(hz, p) ? TICK_ERROR_CYCLES(hz, p) : 0xFFFFFFFFul)
 
-#if (PR3_SETTING > 0xFFFF)
-#undef CLOCK_DIVIDER
-#undef PR3_SETTING
-#define CLOCK_DIVIDER TIMER_PRESCALER_8
-#define PR3_SETTING (SYSTEM_PERIPHERAL_CLOCK/1000/8)
-#endif
+#define TICK_PRESCALE(hz)                                                           \
+    (((TICK_COST(hz, 1) <= TICK_COST(hz, 8)) &&                                     \
+      (TICK_COST(hz, 1) <= TICK_COST(hz, 64)) &&                                    \
+      (TICK_COST(hz, 1) <= TICK_COST(hz, 256))) ? 1 :                               \
+     ((TICK_COST(hz, 8) <= TICK_COST(hz, 64)) &&                                    \
+      (TICK_COST(hz, 8) <= TICK_COST(hz, 256))) ? 8 :                               \
+     (TICK_COST(hz, 64) <= TICK_COST(hz, 256)) ? 64 : 256)
 
-#if (PR3_SETTING > 0xFFFF)
-#undef CLOCK_DIVIDER
-#undef PR3_SETTING
-#define CLOCK_DIVIDER TIMER_PRESCALER_64
-#define PR3_SETTING (SYSTEM_PERIPHERAL_CLOCK/1000/64)
-#endif
+/* Error of the chosen setting in parts per million of the tick rate. */
+#define TICK_ERROR_PPM(hz)          (TICK_VALID(hz, TICK_PRESCALE(hz)) ?                          \
+                                     ((TICK_ERROR_CYCLES(hz, TICK_PRESCALE(hz)) * 1000000ull) /   \
+                                      SYSTEM_PERIPHERAL_CLOCK) : 0xFFFFFFFFul)
 
-#if (PR3_SETTING > 0xFFFF)
-#undef CLOCK_DIVIDER
-#undef PR3_SETTING
-#define CLOCK_DIVIDER TIMER_PRESCALER_256
-#define PR3_SETTING (SYSTEM_PERIPHERAL_CLOCK/1000/256)
+/* In tickless mode Timer3 runs from a 1:64 prescaler so that a single period
+ * can span many ticks.  At 16MHz Fcy one tick is 250 counts and a period can
+ * cover up to 262 ticks. */
+#define TICKLESS_PRESCALE 64
+#define TICKLESS_COUNTS_PER_TICK (SYSTEM_PERIPHERAL_CLOCK/1000/64)
+
+#if ((SYSTEM_PERIPHERAL_CLOCK/64) % 1000) != 0
+#pragma message "Fcy/64 is not a whole number of kHz.  Tickless mode will drift from real time."
 #endif
 
 
 /* Compiler checks and configuration *******************************/
 #ifndef TIMER_MAX_1MS_CLIENTS
-    #define TIMER_MAX_1MS_CLIENTS 10
+    #define TIMER_MAX_1MS_CLIENTS 64
+#endif
+
+/* Largest error allowed between a configured tick rate and what Timer3 can
+ * produce, in parts per million. */
+#ifndef TIMER_TICK_TOLERANCE_PPM
+    #define TIMER_TICK_TOLERANCE_PPM 100
+#endif
+
+#if (TICK_ERROR_PPM(1000) > TIMER_TICK_TOLERANCE_PPM)
+    #error "Timer3 cannot produce a 1ms tick from this peripheral clock within TIMER_TICK_TOLERANCE_PPM."
+#endif
+
+#if (TICK_ERROR_PPM(4000) > TIMER_TICK_TOLERANCE_PPM)
+    #error "Timer3 cannot produce a 250us tick from this peripheral clock within TIMER_TICK_TOLERANCE_PPM."
+#endif
+
+#if (TICK_ERROR_PPM(10000) > TIMER_TICK_TOLERANCE_PPM)
+    #error "Timer3 cannot produce a 100us tick from this peripheral clock within TIMER_TICK_TOLERANCE_PPM."
+#endif
+
+#if defined(TIMER_CUSTOM_TICK_HZ)
+    #if (TIMER_CUSTOM_TICK_HZ < 1)
+        #error "TIMER_CUSTOM_TICK_HZ must be at least 1."
+    #elif (TICK_ERROR_PPM(TIMER_CUSTOM_TICK_HZ) > TIMER_TICK_TOLERANCE_PPM)
+        #error "Timer3 cannot produce TIMER_CUSTOM_TICK_HZ from this peripheral clock within TIMER_TICK_TOLERANCE_PPM."
+    #endif
+#endif
+
+#if (TIMER_MAX_1MS_CLIENTS > 255)
+    #error "TIMER_MAX_1MS_CLIENTS must be at most 255."
+#endif
+
+/* Number of buckets in the timing wheel.  A request is kept in the bucket
+ * selected by the low bits of its deadline, so each tick only visits the
+ * requests whose deadline falls on that bucket. */
+#ifndef TIMER_WHEEL_SIZE
+    #define TIMER_WHEEL_SIZE 256
+#endif
+
+#if ((TIMER_WHEEL_SIZE & (TIMER_WHEEL_SIZE - 1)) != 0) || (TIMER_WHEEL_SIZE > 256)
+    #error "TIMER_WHEEL_SIZE must be a power of two no larger than 256."
+#endif
+
+/* Depth of the queue of deferred handlers waiting for TIMER_Dispatch().  A
+ * live request is queued at most once at a time, but an entry stays behind
+ * when its request is freed, so the queue can still fill up if
+ * TIMER_Dispatch() is not called for a while.  Deadlines that find it full
+ * are counted as missed, see TIMER_DeferredPush(). */
+#ifndef TIMER_DEFERRED_QUEUE_SIZE
+    #define TIMER_DEFERRED_QUEUE_SIZE 64
+#endif
+
+#if ((TIMER_DEFERRED_QUEUE_SIZE & (TIMER_DEFERRED_QUEUE_SIZE - 1)) != 0) || (TIMER_DEFERRED_QUEUE_SIZE > 256)
+    #error "TIMER_DEFERRED_QUEUE_SIZE must be a power of two no larger than 256."
+#endif
+
+#if (TIMER_DEFERRED_QUEUE_SIZE < TIMER_MAX_1MS_CLIENTS)
+    #error "TIMER_DEFERRED_QUEUE_SIZE must not be smaller than TIMER_MAX_1MS_CLIENTS."
+#endif
+
+/* Longest tickless period, limited by the 16-bit period register and by the
+ * wheel, which can only look ahead one revolution. */
+#if ((0x10000ul / TICKLESS_COUNTS_PER_TICK) < TIMER_WHEEL_SIZE)
+    #define TICKLESS_MAX_TICKS (0x10000ul / TICKLESS_COUNTS_PER_TICK)
+#else
+    #define TICKLESS_MAX_TICKS TIMER_WHEEL_SIZE
 #endif
 
+/* Counts left between reading TMR3 and writing PR3 so that the new period
+ * is never set behind the running counter. */
+#define TICKLESS_MARGIN_COUNTS 4
+
+
 /* Definitions *****************************************************/
 #define STOP_TIMER_IN_IDLE_MODE     0x2000
 #define TIMER_SOURCE_INTERNAL       0x0000
@@ -65,32 +148,168 @@ limitations under the License.
 #define TIMER_ON                    0x8000
 #define GATED_TIME_DISABLED         0x0000
 #define TIMER_16BIT_MODE            0x0000
+#define TIMER_32BIT_MODE            0x0008
 
 #define TIMER_PRESCALER_1           0x0000
 #define TIMER_PRESCALER_8           0x0010
 #define TIMER_PRESCALER_64          0x0020
 #define TIMER_PRESCALER_256         0x0030
+#define TIMER_DIVIDER(prescale)     (((prescale) == 1) ? TIMER_PRESCALER_1 :  \
+                                     ((prescale) == 8) ? TIMER_PRESCALER_8 :  \
+                                     ((prescale) == 64) ? TIMER_PRESCALER_64 : \
+                                     TIMER_PRESCALER_256)
 #define TIMER_INTERRUPT_PRIORITY    0x0001
 #define TIMER_INTERRUPT_PRIORITY_4  0x0004
 
+#define TIMER_WHEEL_MASK            (TIMER_WHEEL_SIZE - 1)
+#define TIMER_DEFERRED_QUEUE_MASK   (TIMER_DEFERRED_QUEUE_SIZE - 1)
+#define REQUEST_NONE                0xFF
+
+/* The command queue has the same bound as the deferred queue: a slot is
+ * listed in it at most once at a time. */
+#define COMMAND_QUEUE_SIZE          TIMER_DEFERRED_QUEUE_SIZE
+#define COMMAND_QUEUE_MASK          (COMMAND_QUEUE_SIZE - 1)
+
+#define REQUEST_FREE                0
+#define REQUEST_CLAIMED             1   /* being filled in by its owner */
+#define REQUEST_PENDING             2   /* published, waiting to be linked */
+#define REQUEST_ARMED               3   /* linked into the wheel */
+#define REQUEST_FIRED               4   /* one-shot waiting for TIMER_Dispatch() */
+
+/* Caller contexts of the request API, told apart by the CPU priority. */
+#define CONTEXT_MAIN                0   /* IPL 0, publishes to the timer ISR */
+#define CONTEXT_TIMER               1   /* timer priority, owns the wheel */
+#define CONTEXT_OTHER               2   /* any other priority, rejected */
+
+/* A handle is the slot number plus one, so that zero is never valid, with
+ * the slot's generation in the upper byte to reject stale handles. */
+#define HANDLE_MAKE(index)          ((TIMER_HANDLE)(((uint16_t)requests[(index)].generation << 8) | ((index) + 1)))
+#define HANDLE_INDEX(handle)        ((uint8_t)((handle) & 0xFF) - 1)
+#define HANDLE_GENERATION(handle)   ((uint8_t)((handle) >> 8))
+
 /* Type Definitions ************************************************/
 typedef struct
 {
     TICK_HANDLER handle;
+    TIMER_CALLBACK callback;
+    void *context;
     uint32_t rate;
-    uint32_t count;
+    uint32_t expires;
+    uint8_t next;
+    uint8_t previous;
+    uint8_t flags;
+    volatile uint8_t state;
+    volatile uint8_t generation;
+    volatile bool queued;
+    volatile bool syncing;
+    volatile bool cancelled;
+    volatile uint8_t cancelled_generation;
+    /* Deferred calls owed: raised by the timer ISR, served by
+     * TIMER_Dispatch(). */
+    volatile uint8_t raised;
+    volatile uint8_t served;
+    volatile uint32_t missed;
+#if defined(TIMER_ENABLE_STATS)
+    uint32_t due;
+#endif
 } TICK_REQUEST;
 
+/* Copy of the function to call, taken before a one-shot slot is freed. */
+typedef struct
+{
+    TICK_HANDLER handle;
+    TIMER_CALLBACK callback;
+    void *context;
+} TICK_CALL;
+
+#if defined(TIMER_ENABLE_STATS)
+typedef struct
+{
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t max_lateness_cycles;
+} TICK_STATISTICS;
+#endif
+
 /* Variables *******************************************************/
 static TICK_REQUEST requests[TIMER_MAX_1MS_CLIENTS];
+static uint8_t wheel[TIMER_WHEEL_SIZE];
+static uint8_t cursor = REQUEST_NONE;
+static volatile uint32_t ticks;
 static bool configured = false;
 
+/* Set while the timer interrupts run, which re-evaluate the tickless
+ * period themselves before they return. */
+static volatile bool servicing = false;
+
+/* Slot that main context is about to claim, skipped by claims made at the
+ * timer priority. */
+static volatile uint8_t claiming = REQUEST_NONE;
+
+static bool tickless = false;
+static uint16_t tickless_interval;
+
+/* Length of one tick in Fcy cycles and the Timer3 prescaler in use, used
+ * to count the ticks between two period matches on the timestamp. */
+static uint32_t tick_cycles;
+static uint16_t tick_prescale;
+
+/* Timestamp of the last period match and the tick the current pass of
+ * the Timer3 ISR runs up to.  Ticks serviced before that are late. */
+static uint32_t last_match;
+static uint32_t service_through;
+
+#if defined(TIMER_ENABLE_STATS)
+static TICK_STATISTICS statistics[TIMER_MAX_1MS_CLIENTS];
+
+/* Timestamp at which the tick being serviced was due. */
+static uint32_t tick_timestamp;
+#endif
+
+/* Upper bits of the Timer4/Timer5 timestamp counter. */
+static volatile uint16_t timestamp_overflows;
+
+/* Single producer (main context), single consumer (timer interrupts) ring
+ * of slots whose state has been changed by main context. */
+static uint8_t command_queue[COMMAND_QUEUE_SIZE];
+static volatile uint8_t command_head;
+static volatile uint8_t command_tail;
+
+/* Single producer (timer ISR), single consumer (TIMER_Dispatch) ring.  The
+ * indexes are wider than the queue so that a full queue of 256 entries can
+ * be told from an empty one. */
+static TIMER_HANDLE deferred_queue[TIMER_DEFERRED_QUEUE_SIZE];
+static volatile uint16_t deferred_head;
+static volatile uint16_t deferred_tail;
+
+/* Private Functions ***********************************************/
+static void TIMER_WheelInsert(uint8_t index);
+static void TIMER_WheelRemove(uint8_t index);
+static void TIMER_ServiceTick(void);
+static uint16_t TIMER_TicklessNextDeadline(void);
+static void TIMER_TicklessProgram(uint16_t interval);
+static uint32_t TIMER_TicklessNow(void);
+static void TIMER_DeferredPush(uint8_t index);
+static bool TIMER_Overrun(uint8_t index);
+static void TIMER_TimestampStart(void);
+static TIMER_HANDLE TIMER_Register(TICK_HANDLER handle, TIMER_CALLBACK callback, void *context, uint32_t rate, TIMER_FLAGS flags);
+static uint8_t TIMER_Context(void);
+static uint8_t TIMER_Claim(uint8_t context);
+static void TIMER_Sync(uint8_t index);
+static void TIMER_Publish(uint32_t now);
+static bool TIMER_CancelRequested(uint8_t index);
+static void TIMER_Release(uint8_t index);
+static void TIMER_Take(uint8_t index, TICK_CALL *call);
+static void TIMER_Call(uint8_t index, const TICK_CALL *call, uint32_t due);
+
 /*********************************************************************
 * Function: void TIMER_CancelTick(TICK_HANDLER handle)
 *
 * Overview: Cancels a tick request.
 *
-* PreCondition: None
+* PreCondition: Called from main context or at the timer priority
 *
 * Input:  handle - the function that was handling the tick request
 *
@@ -101,21 +320,86 @@ void TIMER_CancelTick(TICK_HANDLER handle)
 {
     uint8_t i;
 
+    if(handle == NULL)
+    {
+        return;
+    }
+
     for(i = 0; i < TIMER_MAX_1MS_CLIENTS; i++)
     {
-        if(requests[i].handle == handle)
+        if((requests[i].state >= REQUEST_PENDING) && (requests[i].handle == handle))
         {
-            requests[i].handle = NULL;
+            TIMER_Cancel(HANDLE_MAKE(i));
         }
     }
 }
 
+/*********************************************************************
+* Function: bool TIMER_Cancel(TIMER_HANDLE handle)
+*
+* Overview: Cancels a request by the handle returned from TIMER_Schedule().
+*           From main context the cancel is published to the timer
+*           interrupt, which will not call the request again.  At the
+*           timer priority the request is freed directly.
+*
+* PreCondition: Called from main context or at the timer priority
+*
+* Input:  handle - the request to cancel
+*
+* Output: bool - true if the request was still pending, false if it had
+*         already completed, the handle is not valid or the caller runs
+*         at another priority
+*
+********************************************************************/
+bool TIMER_Cancel(TIMER_HANDLE handle)
+{
+    uint8_t i = HANDLE_INDEX(handle);
+    uint8_t generation = HANDLE_GENERATION(handle);
+    uint8_t context = TIMER_Context();
+
+    if((i >= TIMER_MAX_1MS_CLIENTS) || (context == CONTEXT_OTHER))
+    {
+        return false;
+    }
+
+    if((requests[i].state < REQUEST_PENDING) || (requests[i].generation != generation))
+    {
+        return false;
+    }
+
+    if(context == CONTEXT_TIMER)
+    {
+        TIMER_Release(i);
+        return true;
+    }
+
+    if(TIMER_CancelRequested(i) == true)
+    {
+        return false;
+    }
+
+    requests[i].cancelled_generation = generation;
+    requests[i].cancelled = true;
+
+    if(requests[i].generation != generation)
+    {
+        /* The slot was freed while the flag was being raised: either the
+         * timer interrupt acted on the flag, which it acknowledges by
+         * clearing it, or the request completed first. */
+        return (requests[i].cancelled == false);
+    }
+
+    TIMER_Sync(i);
+
+    return true;
+}
+
 /*********************************************************************
  * Function: bool TIMER_RequestTick(TICK_HANDLER handle, uint32_t rate)
  *
  * Overview: Requests to receive a periodic event.
  *
- * PreCondition: None
+ * PreCondition: Called from main context or at the timer priority
  *
  * Input:  handle - the function that will be called when the time event occurs
  *         rate - the number of ticks per event.
@@ -124,27 +408,316 @@ void TIMER_CancelTick(TICK_HANDLER handle)
  *
  ********************************************************************/
 bool TIMER_RequestTick ( TICK_HANDLER handle , uint32_t rate )
+{
+    return TIMER_RequestTickWithFlags(handle, rate, TIMER_FLAG_NONE);
+}
+
+/*********************************************************************
+ * Function: bool TIMER_RequestTickWithFlags(TICK_HANDLER handle,
+ *                                           uint32_t rate,
+ *                                           TIMER_FLAGS flags)
+ *
+ * Overview: Requests to receive a periodic event, choosing the context
+ *           the handler runs in.
+ *
+ * PreCondition: Called from main context or at the timer priority
+ *
+ * Input:  handle - the function that will be called when the time event occurs
+ *         rate - the number of ticks per event.
+ *         flags - TIMER_FLAG_DEFERRED to run the handler from TIMER_Dispatch()
+ *                 instead of the timer ISR.
+ *
+ * Output: bool - true if successful, false if unsuccessful
+ *
+ ********************************************************************/
+bool TIMER_RequestTickWithFlags ( TICK_HANDLER handle , uint32_t rate , TIMER_FLAGS flags )
+{
+    if(handle == NULL)
+    {
+        return false;
+    }
+
+    return (TIMER_Register(handle, NULL, NULL, rate, flags) != TIMER_HANDLE_INVALID);
+}
+
+/*********************************************************************
+ * Function: TIMER_HANDLE TIMER_Schedule(TIMER_CALLBACK callback,
+ *                                       void *context,
+ *                                       uint32_t rate,
+ *                                       TIMER_FLAGS flags)
+ *
+ * Overview: Requests a periodic or one-shot event that passes a context
+ *           pointer to the callback.
+ *
+ * PreCondition: Called from main context or at the timer priority
+ *
+ * Input:  callback - the function that will be called when the time event occurs
+ *         context - passed to the callback
+ *         rate - the number of ticks until (and, if periodic, between) events
+ *         flags - TIMER_FLAG_ONE_SHOT and/or TIMER_FLAG_DEFERRED
+ *
+ * Output: TIMER_HANDLE - handle for TIMER_Cancel(), or TIMER_HANDLE_INVALID
+ *
+ ********************************************************************/
+TIMER_HANDLE TIMER_Schedule ( TIMER_CALLBACK callback , void *context , uint32_t rate , TIMER_FLAGS flags )
+{
+    if(callback == NULL)
+    {
+        return TIMER_HANDLE_INVALID;
+    }
+
+    return TIMER_Register(NULL, callback, context, rate, flags);
+}
+
+/*********************************************************************
+ * Function: static TIMER_HANDLE TIMER_Register(TICK_HANDLER handle,
+ *                                              TIMER_CALLBACK callback,
+ *                                              void *context,
+ *                                              uint32_t rate,
+ *                                              TIMER_FLAGS flags)
+ *
+ * Overview: Claims a free slot, fills it in and publishes it.  The slot
+ *           state is written last, so the timer interrupt never sees a
+ *           partly initialised request.
+ *
+ * PreCondition: Called from main context or at the timer priority,
+ *               otherwise the request is refused
+ *
+ * Input:  handle, callback, context - the function to call, one of
+ *         handle or callback is set
+ *         rate - the number of ticks per event, at least 1
+ *         flags - request options
+ *
+ * Output: TIMER_HANDLE - handle of the request, or TIMER_HANDLE_INVALID
+ *
+ ********************************************************************/
+static TIMER_HANDLE TIMER_Register(TICK_HANDLER handle, TIMER_CALLBACK callback, void *context, uint32_t rate, TIMER_FLAGS flags)
 {
     uint8_t i;
+    uint8_t caller = TIMER_Context();
+    TIMER_HANDLE result;
 	
-    if(configured == false)
+    if((configured == false) || (rate == 0) || (caller == CONTEXT_OTHER))
     {
-        return false;
+        return TIMER_HANDLE_INVALID;
+    }
+
+    i = TIMER_Claim(caller);
+
+    if(i == REQUEST_NONE)
+    {
+        return TIMER_HANDLE_INVALID;
+    }
+
+    requests[i].handle = handle;
+    requests[i].callback = callback;
+    requests[i].context = context;
+    requests[i].rate = rate;
+    requests[i].flags = flags;
+    requests[i].queued = false;
+    requests[i].raised = 0;
+    requests[i].served = 0;
+    requests[i].missed = 0;
+#if defined(TIMER_ENABLE_STATS)
+    memset(&statistics[i], 0, sizeof(statistics[i]));
+#endif
+
+    result = HANDLE_MAKE(i);
+
+    if(caller == CONTEXT_TIMER)
+    {
+        /* The timer interrupts cannot run at this priority, so the wheel
+         * can be used directly.  Outside them the tick count of tickless
+         * mode lags, and the period may have to be shortened. */
+        if((servicing == true) || (tickless == false))
+        {
+            requests[i].expires = ticks + rate;
+        }
+        else
+        {
+            requests[i].expires = TIMER_TicklessNow() + rate;
+            IFS0bits.T2IF = 1;
+        }
+
+        requests[i].state = REQUEST_ARMED;
+        TIMER_WheelInsert(i);
+    }
+    else
+    {
+        requests[i].state = REQUEST_PENDING;
+        TIMER_Sync(i);
     }
 
+    return result;
+}
+
+/*********************************************************************
+ * Function: static uint8_t TIMER_Claim(uint8_t context)
+ *
+ * Overview: Finds a free slot and marks it claimed.  The timer interrupt
+ *           can preempt main context but not the other way round, so
+ *           main context announces the slot it is testing first and the
+ *           interrupt leaves that slot alone.
+ *
+ * PreCondition: Called from main context or at the timer priority
+ *
+ * Input:  context - CONTEXT_MAIN or CONTEXT_TIMER, see TIMER_Context()
+ *
+ * Output: uint8_t - the claimed slot, or REQUEST_NONE if the table is full
+ *
+ ********************************************************************/
+static uint8_t TIMER_Claim(uint8_t context)
+{
+    uint8_t i;
+
     for(i = 0; i < TIMER_MAX_1MS_CLIENTS; i++)
     {
-        if(requests[i].handle == NULL)
+        if(context == CONTEXT_TIMER)
+        {
+            if((i != claiming) && (requests[i].state == REQUEST_FREE))
+            {
+                requests[i].state = REQUEST_CLAIMED;
+                return i;
+            }
+        }
+        else
         {
-            requests[i].handle = handle;
-            requests[i].rate = rate;
-            requests[i].count = 0;
+            claiming = i;
 
-            return true;
+            if(requests[i].state == REQUEST_FREE)
+            {
+                requests[i].state = REQUEST_CLAIMED;
+                claiming = REQUEST_NONE;
+                return i;
+            }
+        }
+    }
+
+    claiming = REQUEST_NONE;
+    return REQUEST_NONE;
+}
+
+/*********************************************************************
+ * Function: static uint8_t TIMER_Context(void)
+ *
+ * Overview: Tells the caller's context from the CPU priority.  Main
+ *           context runs at IPL 0 and is the only producer of the command
+ *           queue.  Any interrupt at the timer priority, the timer ISRs
+ *           included, can neither preempt them nor be preempted by them,
+ *           so it may use the wheel directly.  Interrupts at any other
+ *           priority can preempt both and are refused.
+ *
+ * PreCondition: None
+ *
+ * Input:  None
+ *
+ * Output: uint8_t - CONTEXT_MAIN, CONTEXT_TIMER or CONTEXT_OTHER
+ *
+ ********************************************************************/
+static uint8_t TIMER_Context(void)
+{
+    uint8_t ipl = SRbits.IPL;
+
+    if(ipl == 0)
+    {
+        return CONTEXT_MAIN;
+    }
+
+    if(ipl == TIMER_INTERRUPT_PRIORITY)
+    {
+        return CONTEXT_TIMER;
+    }
+
+    return CONTEXT_OTHER;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_Sync(uint8_t index)
+ *
+ * Overview: Lists a slot for the timer interrupt to look at and raises
+ *           the Timer2 interrupt flag so that it does so straight away.
+ *           Timer2 itself is not running; its interrupt only serves as a
+ *           software interrupt at the timer priority.
+ *
+ * PreCondition: Called from main context (IPL 0), the only producer of
+ *               the command queue
+ *
+ * Input:  index - the slot that changed
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_Sync(uint8_t index)
+{
+    if(requests[index].syncing == false)
+    {
+        requests[index].syncing = true;
+        command_queue[command_head & COMMAND_QUEUE_MASK] = index;
+        command_head++;
+    }
+
+    IFS0bits.T2IF = 1;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_Publish(uint32_t now)
+ *
+ * Overview: Applies the changes main context made to the listed slots:
+ *           links new requests into the wheel and frees cancelled ones.
+ *
+ * PreCondition: Called from the timer interrupts
+ *
+ * Input:  now - the current tick, from which new deadlines are measured
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_Publish(uint32_t now)
+{
+    uint8_t i;
+
+    while(command_tail != command_head)
+    {
+        i = command_queue[command_tail & COMMAND_QUEUE_MASK];
+        command_tail++;
+
+        /* Cleared before the slot is read, so a change made after this
+         * point lists the slot again. */
+        requests[i].syncing = false;
+
+        if(TIMER_CancelRequested(i) == true)
+        {
+            requests[i].cancelled = false;
+            TIMER_Release(i);
+        }
+        else if(requests[i].state == REQUEST_PENDING)
+        {
+            requests[i].expires = now + requests[i].rate;
+            requests[i].state = REQUEST_ARMED;
+            TIMER_WheelInsert(i);
         }
     }
+}
 
-    return false;
+/*********************************************************************
+ * Function: static bool TIMER_CancelRequested(uint8_t index)
+ *
+ * Overview: Tells whether main context has cancelled the current
+ *           occupant of a slot.  The flag is tagged with the generation
+ *           it was raised for, so a flag left over from an earlier
+ *           occupant is ignored.
+ *
+ * PreCondition: None
+ *
+ * Input:  index - the slot to test
+ *
+ * Output: bool - true if the request must not be called again
+ *
+ ********************************************************************/
+static bool TIMER_CancelRequested(uint8_t index)
+{
+    return ((requests[index].cancelled == true) &&
+            (requests[index].cancelled_generation == requests[index].generation));
 }
 
 /*********************************************************************
@@ -161,74 +734,1032 @@ bool TIMER_RequestTick ( TICK_HANDLER handle , uint32_t rate )
  ********************************************************************/
 bool TIMER_SetConfiguration ( TIMER_CONFIGURATIONS configuration )
 {
+    uint8_t i;
+    uint8_t generation;
+    uint32_t counts;
+    uint16_t prescale;
+
     switch(configuration)
     {
         case TIMER_CONFIGURATION_1MS:
-            memset(requests, 0, sizeof(requests));
-            
-            IPC2bits.T3IP = TIMER_INTERRUPT_PRIORITY;
-            IFS0bits.T3IF = 0;
+            counts = TICK_COUNTS(1000, TICK_PRESCALE(1000));
+            prescale = TICK_PRESCALE(1000);
+            break;
 
-            TMR3 = 0;
+        case TIMER_CONFIGURATION_250US:
+            counts = TICK_COUNTS(4000, TICK_PRESCALE(4000));
+            prescale = TICK_PRESCALE(4000);
+            break;
 
-            PR3 = PR3_SETTING;
-            T3CON = TIMER_ON |
-                    STOP_TIMER_IN_IDLE_MODE |
-                    TIMER_SOURCE_INTERNAL |
-                    GATED_TIME_DISABLED |
-                    TIMER_16BIT_MODE |
-                    CLOCK_DIVIDER;
+        case TIMER_CONFIGURATION_100US:
+            counts = TICK_COUNTS(10000, TICK_PRESCALE(10000));
+            prescale = TICK_PRESCALE(10000);
+            break;
 
-            IEC0bits.T3IE = 1;
+#if defined(TIMER_CUSTOM_TICK_HZ)
+        case TIMER_CONFIGURATION_CUSTOM:
+            counts = TICK_COUNTS(TIMER_CUSTOM_TICK_HZ, TICK_PRESCALE(TIMER_CUSTOM_TICK_HZ));
+            prescale = TICK_PRESCALE(TIMER_CUSTOM_TICK_HZ);
+            break;
+#endif
 
-            configured = true;
-            return true;
+        case TIMER_CONFIGURATION_TICKLESS:
+            counts = TICKLESS_COUNTS_PER_TICK;
+            prescale = TICKLESS_PRESCALE;
+            break;
 
         case TIMER_CONFIGURATION_OFF:
             IEC0bits.T3IE = 0;
+            IEC0bits.T2IE = 0;
             configured = false;
             return true;
+
+        default:
+            return false;
     }
 
-    return false;
-}
+    IEC0bits.T3IE = 0;
+    IEC0bits.T2IE = 0;
 
-/****************************************************************************
-  Function:
-    void __attribute__((__interrupt__, auto_psv)) _T3Interrupt(void)
+    /* Keep the generations so that handles from before the
+     * reconfiguration stay invalid. */
+    for(i = 0; i < TIMER_MAX_1MS_CLIENTS; i++)
+    {
+        generation = requests[i].generation + 1;
+        memset(&requests[i], 0, sizeof(requests[i]));
+        requests[i].generation = generation;
+    }
+#if defined(TIMER_ENABLE_STATS)
+    memset(statistics, 0, sizeof(statistics));
+#endif
+    memset(wheel, REQUEST_NONE, sizeof(wheel));
+    cursor = REQUEST_NONE;
+    claiming = REQUEST_NONE;
+    command_head = 0;
+    command_tail = 0;
+    deferred_head = 0;
+    deferred_tail = 0;
+    ticks = 0;
+    tickless = (configuration == TIMER_CONFIGURATION_TICKLESS);
+    servicing = false;
+    tick_cycles = counts * prescale;
+    tick_prescale = prescale;
 
-  Description:
-    Timer ISR, used to update application state. If no transfers are pending
-    new input request is scheduled.
-  Precondition:
-    None
+    TIMER_TimestampStart();
 
-  Parameters:
-    None
+    IPC1bits.T2IP = TIMER_INTERRUPT_PRIORITY;
+    IFS0bits.T2IF = 0;
 
-  Return Values:
-    None
+    IPC2bits.T3IP = TIMER_INTERRUPT_PRIORITY;
+    IFS0bits.T3IF = 0;
 
-  Remarks:
-    None
+    TMR3 = 0;
+
+    if(tickless == true)
+    {
+        /* Nothing is scheduled yet, so sleep for the longest period. */
+        tickless_interval = TICKLESS_MAX_TICKS;
+        PR3 = (TICKLESS_MAX_TICKS * TICKLESS_COUNTS_PER_TICK) - 1;
+    }
+    else
+    {
+        /* The period is PR3 + 1 counts. */
+        PR3 = counts - 1;
+    }
+
+    /* The timer keeps running in Idle, so the tick count follows real time
+     * and a tickless period can wake the core. */
+    T3CON = TIMER_ON |
+            TIMER_SOURCE_INTERNAL |
+            GATED_TIME_DISABLED |
+            TIMER_16BIT_MODE |
+            TIMER_DIVIDER(prescale);
+
+    last_match = TIMER_GetTicks();
+
+    IEC0bits.T2IE = 1;
+    IEC0bits.T3IE = 1;
+
+    configured = true;
+    return true;
+}
+
+/****************************************************************************
+  Function:
+    void __attribute__((__interrupt__, auto_psv)) _T3Interrupt(void)
+
+  Description:
+    Timer ISR, used to update application state.  Only the wheel bucket of
+    the current tick is walked, so the cost per tick depends on the number
+    of requests that hash to that bucket rather than on the client limit.
+    The ticks since the last period match are counted on the timestamp, so
+    a period lost while the interrupt was held off is serviced late rather
+    than dropped.  In tickless mode the period is then reprogrammed to end
+    at the next occupied bucket.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+
+  Remarks:
+    None
   ***************************************************************************/
 void __attribute__((__interrupt__, auto_psv)) _T3Interrupt( void )
+{
+    uint32_t cycles = tick_cycles;
+    /* TMR3 has counted on from zero since the period match. */
+    uint32_t match = TIMER_GetTicks() - ((uint32_t)TMR3 * tick_prescale);
+    uint32_t elapsed = match - last_match;
+
+    /* Rounding absorbs the few cycles between reading the two timers.  The
+     * division is only needed when more than one tick has passed, which
+     * keeps the common case cheap at high tick rates. */
+    if(elapsed < (cycles + (cycles / 2)))
+    {
+        elapsed = 1;
+    }
+    else
+    {
+        elapsed = (elapsed + (cycles / 2)) / cycles;
+    }
+
+    last_match = match;
+
+    servicing = true;
+
+    service_through = ticks + elapsed;
+
+    while(ticks != service_through)
+    {
+#if defined(TIMER_ENABLE_STATS)
+        tick_timestamp = match - ((service_through - ticks - 1) * cycles);
+#endif
+        TIMER_ServiceTick();
+    }
+
+    TIMER_Publish(ticks);
+
+    servicing = false;
+
+    IFS0bits.T3IF = 0;
+
+    if(tickless == true)
+    {
+        TIMER_TicklessProgram(TIMER_TicklessNextDeadline());
+    }
+}
+
+/****************************************************************************
+  Function:
+    void __attribute__((__interrupt__, auto_psv)) _T2Interrupt(void)
+
+  Description:
+    Software interrupt raised by TIMER_Sync() at the same priority as the
+    Timer3 ISR, so the two never preempt each other.  Applies the changes
+    published by main context.  In tickless mode the deadline of a new
+    request is measured from the timestamp and the current period is
+    shortened if the request is due before it ends.  Timer3 is left
+    running throughout, so no counts are lost to the tick.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+void __attribute__((__interrupt__, auto_psv)) _T2Interrupt( void )
+{
+    uint16_t distance;
+
+    IFS0bits.T2IF = 0;
+
+    servicing = true;
+
+    if(tickless == false)
+    {
+        TIMER_Publish(ticks);
+    }
+    else
+    {
+        TIMER_Publish(TIMER_TicklessNow());
+
+        /* If the period has already ended, the Timer3 ISR runs next and
+         * picks the new deadlines when it reprograms the period.  A match
+         * that lands after this check is harmless: that ISR counts the
+         * elapsed ticks on the timestamp and reprograms the period. */
+        if(IFS0bits.T3IF == 0)
+        {
+            distance = TIMER_TicklessNextDeadline();
+
+            if(distance < tickless_interval)
+            {
+                TIMER_TicklessProgram(distance);
+            }
+        }
+    }
+
+    servicing = false;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_ServiceTick(void)
+ *
+ * Overview: Advances the tick count and calls every request due on it.
+ *
+ * PreCondition: Called from the timer ISR
+ *
+ * Input:  None
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_ServiceTick(void)
 {
     uint8_t i;
+    bool fire;
+    TICK_CALL call;
 
-    for(i = 0; i < TIMER_MAX_1MS_CLIENTS; i++)
+    ticks++;
+
+    cursor = wheel[(uint8_t)ticks & TIMER_WHEEL_MASK];
+
+    while(cursor != REQUEST_NONE)
     {
-        if(requests[i].handle != NULL)
+        i = cursor;
+        cursor = requests[i].next;
+
+        /* Requests more than one wheel revolution away share the bucket
+         * but are left in place until their own deadline comes round. */
+        if(requests[i].expires != ticks)
         {
-            requests[i].count++;
-            
-            if(requests[i].count == requests[i].rate)
+            continue;
+        }
+
+        if(TIMER_CancelRequested(i) == true)
+        {
+            requests[i].cancelled = false;
+            TIMER_Release(i);
+            continue;
+        }
+
+        TIMER_WheelRemove(i);
+
+        if(requests[i].flags & TIMER_FLAG_ONE_SHOT)
+        {
+            requests[i].state = REQUEST_FIRED;
+
+            if(ticks != service_through)
             {
-                requests[i].handle();
-                requests[i].count = 0;
+                requests[i].missed++;
             }
         }
+        else
+        {
+            fire = TIMER_Overrun(i);
+            TIMER_WheelInsert(i);
+
+            if(fire == false)
+            {
+                continue;
+            }
+        }
+
+        if(requests[i].flags & TIMER_FLAG_DEFERRED)
+        {
+            TIMER_DeferredPush(i);
+        }
+        else
+        {
+            TIMER_Take(i, &call);
+#if defined(TIMER_ENABLE_STATS)
+            TIMER_Call(i, &call, tick_timestamp);
+#else
+            TIMER_Call(i, &call, 0);
+#endif
+        }
     }
-    
-    IFS0bits.T3IF = 0;
 }
+
+/*********************************************************************
+ * Function: static bool TIMER_Overrun(uint8_t index)
+ *
+ * Overview: Sets the next deadline of a periodic request that is due.
+ *           Deadlines always stay on the grid set when the request was
+ *           made.  A deadline is late when the pass of the Timer3 ISR
+ *           runs up to a later tick; the overrun policy then decides
+ *           what happens to it and the deadlines that have also passed.
+ *
+ * PreCondition: Called from the timer ISR, request unlinked
+ *
+ * Input:  index - the request that is due
+ *
+ * Output: bool - true if the request is to be called for this deadline
+ *
+ ********************************************************************/
+static bool TIMER_Overrun(uint8_t index)
+{
+    TICK_REQUEST *request = &requests[index];
+    uint32_t passed;
+
+    if(ticks == service_through)
+    {
+        request->expires += request->rate;
+        return true;
+    }
+
+    if((request->flags & (TIMER_FLAG_OVERRUN_SKIP | TIMER_FLAG_OVERRUN_COALESCE)) == 0)
+    {
+        /* Catch up: every deadline is called, this one late. */
+        request->missed++;
+        request->expires += request->rate;
+        return true;
+    }
+
+    /* Deadlines before the end of the pass, this one included. */
+    passed = ((service_through - 1 - ticks) / request->rate) + 1;
+
+    request->missed += passed;
+    request->expires += passed * request->rate;
+
+    if(request->flags & TIMER_FLAG_OVERRUN_SKIP)
+    {
+        return false;
+    }
+
+    /* Coalesce: one call stands for all of them.  A deadline falling on
+     * the end of the pass is on time and is folded in as well. */
+    if(request->expires == service_through)
+    {
+        request->expires += request->rate;
+    }
+
+    return true;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_DeferredPush(uint8_t index)
+ *
+ * Overview: Queues a due request for TIMER_Dispatch().  A request that is
+ *           still waiting from an earlier tick is not queued twice.  If
+ *           its last call has not been served yet the deadline counts as
+ *           missed; with the catch up policy the call is owed and made
+ *           by the same dispatch, otherwise it is folded into the
+ *           waiting call.  A deadline that finds the queue full is
+ *           counted as missed once and its call is dropped, so nothing
+ *           is owed for it: a periodic request is queued again on its
+ *           next deadline, a one-shot request is freed.
+ *
+ * PreCondition: Called from the timer ISR
+ *
+ * Input:  index - the request that is due
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_DeferredPush(uint8_t index)
+{
+    /* Checked before the call is raised, so that the next deadline does
+     * not find it owed and count the same miss again. */
+    if((requests[index].queued == false) &&
+       ((uint16_t)(deferred_head - deferred_tail) >= TIMER_DEFERRED_QUEUE_SIZE))
+    {
+        requests[index].missed++;
+
+        if(requests[index].state == REQUEST_FIRED)
+        {
+            TIMER_Release(index);
+        }
+
+        return;
+    }
+
+    if(requests[index].raised != requests[index].served)
+    {
+        requests[index].missed++;
+
+        if(((requests[index].flags & (TIMER_FLAG_OVERRUN_SKIP | TIMER_FLAG_OVERRUN_COALESCE)) == 0) &&
+           ((uint8_t)(requests[index].raised - requests[index].served) != 0xFF))
+        {
+            requests[index].raised++;
+        }
+    }
+    else
+    {
+        requests[index].raised++;
+    }
+
+    if(requests[index].queued == true)
+    {
+        return;
+    }
+
+    requests[index].queued = true;
+#if defined(TIMER_ENABLE_STATS)
+    requests[index].due = tick_timestamp;
+#endif
+    deferred_queue[deferred_head & TIMER_DEFERRED_QUEUE_MASK] = HANDLE_MAKE(index);
+    deferred_head++;
+}
+
+/*********************************************************************
+ * Function: uint32_t TIMER_GetMissed(TIMER_HANDLE handle)
+ *
+ * Overview: Reads the missed deadline count of a request.
+ *
+ * PreCondition: None
+ *
+ * Input:  handle - the request, as returned by TIMER_Schedule()
+ *
+ * Output: uint32_t - missed deadlines, 0 if the handle is not valid
+ *
+ ********************************************************************/
+uint32_t TIMER_GetMissed(TIMER_HANDLE handle)
+{
+    uint8_t i = HANDLE_INDEX(handle);
+    uint32_t missed;
+
+    if((i >= TIMER_MAX_1MS_CLIENTS) ||
+       (requests[i].state < REQUEST_PENDING) ||
+       (requests[i].generation != HANDLE_GENERATION(handle)))
+    {
+        return 0;
+    }
+
+    /* The count is 32 bits wide and may change between the two word
+     * reads, so read until two reads agree. */
+    do
+    {
+        missed = requests[i].missed;
+    } while(missed != requests[i].missed);
+
+    return missed;
+}
+
+/*********************************************************************
+ * Function: void TIMER_Dispatch(void)
+ *
+ * Overview: Calls the deferred handlers queued by the timer ISR.  Does
+ *           nothing unless called from main context.
+ *
+ * PreCondition: Called from main context
+ *
+ * Input:  None
+ *
+ * Output: None
+ *
+ ********************************************************************/
+void TIMER_Dispatch(void)
+{
+    TIMER_HANDLE handle;
+    uint8_t index;
+    uint8_t generation;
+    TICK_CALL call;
+#if defined(TIMER_ENABLE_STATS)
+    uint32_t due;
+#endif
+
+    if(TIMER_Context() != CONTEXT_MAIN)
+    {
+        return;
+    }
+
+    while(deferred_tail != deferred_head)
+    {
+        handle = deferred_queue[deferred_tail & TIMER_DEFERRED_QUEUE_MASK];
+        deferred_tail++;
+
+        index = HANDLE_INDEX(handle);
+        generation = HANDLE_GENERATION(handle);
+
+        call.handle = requests[index].handle;
+        call.callback = requests[index].callback;
+        call.context = requests[index].context;
+#if defined(TIMER_ENABLE_STATS)
+        due = requests[index].due;
+#endif
+
+        /* The slot is only rewritten after TIMER_Release() has moved its
+         * generation on, so if the generation still matches the copy
+         * above belongs to the request that was queued. */
+        if((requests[index].generation != generation) ||
+           (requests[index].queued == false) ||
+           (TIMER_CancelRequested(index) == true))
+        {
+            continue;
+        }
+
+        requests[index].queued = false;
+
+        /* One call per deadline raised since the last dispatch, stopping
+         * if a handler cancels its own request. */
+        while((requests[index].raised != requests[index].served) &&
+              (requests[index].generation == generation) &&
+              (TIMER_CancelRequested(index) == false))
+        {
+            requests[index].served++;
+
+#if defined(TIMER_ENABLE_STATS)
+            TIMER_Call(index, &call, due);
+#else
+            TIMER_Call(index, &call, 0);
+#endif
+        }
+
+        if((requests[index].state == REQUEST_FIRED) && (requests[index].generation == generation))
+        {
+            /* Only the timer interrupt frees slots. */
+            requests[index].cancelled_generation = generation;
+            requests[index].cancelled = true;
+            TIMER_Sync(index);
+        }
+    }
+}
+
+/*********************************************************************
+ * Function: bool TIMER_IsDispatchPending(void)
+ *
+ * Overview: Tells whether the deferred queue holds entries.
+ *
+ * PreCondition: None
+ *
+ * Input:  None
+ *
+ * Output: bool - true if TIMER_Dispatch() has work to do
+ *
+ ********************************************************************/
+bool TIMER_IsDispatchPending(void)
+{
+    return (deferred_tail != deferred_head);
+}
+
+/*********************************************************************
+ * Function: static void TIMER_Release(uint8_t index)
+ *
+ * Overview: Frees a slot, invalidating its handle.  The generation is
+ *           moved on first so that main context readers notice.
+ *
+ * PreCondition: Called from the timer interrupts
+ *
+ * Input:  index - the slot to free
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_Release(uint8_t index)
+{
+    if(requests[index].state == REQUEST_ARMED)
+    {
+        TIMER_WheelRemove(index);
+    }
+
+    requests[index].generation++;
+    requests[index].queued = false;
+    requests[index].handle = NULL;
+    requests[index].callback = NULL;
+    requests[index].state = REQUEST_FREE;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_Take(uint8_t index, TICK_CALL *call)
+ *
+ * Overview: Copies the function to call for a due request.  A one-shot
+ *           request is freed first so that its callback may schedule a
+ *           new request, possibly in the same slot.
+ *
+ * PreCondition: Called from the timer interrupts
+ *
+ * Input:  index - the due request
+ *         call - where to store the function to call
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_Take(uint8_t index, TICK_CALL *call)
+{
+    call->handle = requests[index].handle;
+    call->callback = requests[index].callback;
+    call->context = requests[index].context;
+
+    if(requests[index].state == REQUEST_FIRED)
+    {
+        TIMER_Release(index);
+    }
+}
+
+
+/*********************************************************************
+ * Function: static uint16_t TIMER_TicklessNextDeadline(void)
+ *
+ * Overview: Finds the distance to the next occupied wheel bucket.  A
+ *           bucket may only hold requests due on a later revolution, in
+ *           which case the wake up simply finds nothing to call.
+ *
+ * PreCondition: Called from the timer ISR
+ *
+ * Input:  None
+ *
+ * Output: uint16_t - number of ticks until the next wake up
+ *
+ ********************************************************************/
+static uint16_t TIMER_TicklessNextDeadline(void)
+{
+    uint16_t distance;
+
+    for(distance = 1; distance < TICKLESS_MAX_TICKS; distance++)
+    {
+        if(wheel[(uint8_t)(ticks + distance) & TIMER_WHEEL_MASK] != REQUEST_NONE)
+        {
+            break;
+        }
+    }
+
+    return distance;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_TicklessProgram(uint16_t interval)
+ *
+ * Overview: Sets the period to end the given number of ticks after the
+ *           last wake up.  If the counter is already past that point the
+ *           period is stretched to the next whole tick so that the ISR can
+ *           still account for the elapsed time exactly.
+ *
+ * PreCondition: Called from the timer interrupts
+ *
+ * Input:  interval - ticks since the last wake up
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_TicklessProgram(uint16_t interval)
+{
+    uint16_t minimum = ((TMR3 + TICKLESS_MARGIN_COUNTS) / TICKLESS_COUNTS_PER_TICK) + 1;
+
+    if(interval < minimum)
+    {
+        interval = minimum;
+    }
+
+    tickless_interval = interval;
+    PR3 = (interval * TICKLESS_COUNTS_PER_TICK) - 1;
+}
+
+/*********************************************************************
+ * Function: static uint32_t TIMER_TicklessNow(void)
+ *
+ * Overview: Works out the current tick in tickless mode, where the tick
+ *           count only moves on at a wake up.  The ticks since the last
+ *           period match are counted on the timestamp, which also covers
+ *           a match whose interrupt is still pending, so Timer3 does not
+ *           have to be stopped to read it.
+ *
+ * PreCondition: Called at the timer interrupt priority
+ *
+ * Input:  None
+ *
+ * Output: uint32_t - the current tick
+ *
+ ********************************************************************/
+static uint32_t TIMER_TicklessNow(void)
+{
+    return ticks + ((TIMER_GetTicks() - last_match) / tick_cycles);
+}
+
+/*********************************************************************
+ * Function: static void TIMER_WheelInsert(uint8_t index)
+ *
+ * Overview: Links a request into the wheel bucket of its deadline.
+ *
+ * PreCondition: Called from the timer interrupts
+ *
+ * Input:  index - the request to link
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_WheelInsert(uint8_t index)
+{
+    uint8_t bucket = (uint8_t)requests[index].expires & TIMER_WHEEL_MASK;
+
+    requests[index].previous = REQUEST_NONE;
+    requests[index].next = wheel[bucket];
+
+    if(wheel[bucket] != REQUEST_NONE)
+    {
+        requests[wheel[bucket]].previous = index;
+    }
+
+    wheel[bucket] = index;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_WheelRemove(uint8_t index)
+ *
+ * Overview: Unlinks a request from its wheel bucket.  If the ISR is
+ *           about to visit the request, it moves on to the next one.
+ *
+ * PreCondition: Called from the timer interrupts
+ *
+ * Input:  index - the request to unlink
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_WheelRemove(uint8_t index)
+{
+    uint8_t bucket = (uint8_t)requests[index].expires & TIMER_WHEEL_MASK;
+    uint8_t next = requests[index].next;
+    uint8_t previous = requests[index].previous;
+
+    if(cursor == index)
+    {
+        cursor = next;
+    }
+
+    if(previous != REQUEST_NONE)
+    {
+        requests[previous].next = next;
+    }
+    else
+    {
+        wheel[bucket] = next;
+    }
+
+    if(next != REQUEST_NONE)
+    {
+        requests[next].previous = previous;
+    }
+
+    requests[index].next = REQUEST_NONE;
+    requests[index].previous = REQUEST_NONE;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_TimestampStart(void)
+ *
+ * Overview: Starts Timer4/Timer5 as a free running 32-bit counter of the
+ *           peripheral clock.  It is left running if already started, so
+ *           timestamps stay monotonic across reconfigurations of Timer3.
+ *
+ * PreCondition: None
+ *
+ * Input:  None
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_TimestampStart(void)
+{
+    if(T4CONbits.TON == 1)
+    {
+        return;
+    }
+
+    timestamp_overflows = 0;
+
+    IPC7bits.T5IP = TIMER_INTERRUPT_PRIORITY_4;
+    IFS1bits.T5IF = 0;
+
+    TMR5 = 0;
+    TMR4 = 0;
+    PR5 = 0xFFFF;
+    PR4 = 0xFFFF;
+
+    /* Keeps counting in Idle so that tickless sleeps are timed too. */
+    T4CON = TIMER_ON |
+            TIMER_SOURCE_INTERNAL |
+            GATED_TIME_DISABLED |
+            TIMER_32BIT_MODE |
+            TIMER_PRESCALER_1;
+
+    IEC1bits.T5IE = 1;
+}
+
+/*********************************************************************
+ * Function: uint32_t TIMER_GetTicks(void)
+ *
+ * Overview: Reads the free running timestamp counter.
+ *
+ * PreCondition: Timer configured via TIMER_SetConfiguration()
+ *
+ * Input:  None
+ *
+ * Output: uint32_t - peripheral clock (Fcy) cycles, wrapping at 2^32
+ *
+ ********************************************************************/
+uint32_t TIMER_GetTicks(void)
+{
+    uint16_t high;
+    uint16_t low;
+
+    /* Reading TMR4 latches TMR5 into TMR5HLD.  An interrupt that reads the
+     * timestamp in between re-latches it, so retry until both agree. */
+    do
+    {
+        high = TMR5;
+        low = TMR4;
+    } while(high != TMR5HLD);
+
+    return ((uint32_t)high << 16) | low;
+}
+
+/*********************************************************************
+ * Function: uint32_t TIMER_GetMicros(void)
+ *
+ * Overview: Reads the free running timestamp in microseconds.
+ *
+ * PreCondition: Timer configured via TIMER_SetConfiguration()
+ *
+ * Input:  None
+ *
+ * Output: uint32_t - microseconds, wrapping at 2^32
+ *
+ ********************************************************************/
+uint32_t TIMER_GetMicros(void)
+{
+    uint16_t overflows;
+    uint32_t cycles;
+    bool pending;
+
+    /* The overflow interrupt may be masked by the caller's priority, in
+     * which case a counter that has just wrapped is not yet accounted.
+     * The flag is sampled inside the loop: if the interrupt clears it
+     * after the sample, the overflow count changes and the read is
+     * repeated, so the flag always belongs to the count read with it. */
+    do
+    {
+        overflows = timestamp_overflows;
+        cycles = TIMER_GetTicks();
+        pending = (IFS1bits.T5IF == 1);
+    } while(overflows != timestamp_overflows);
+
+    if((pending == true) && (cycles < 0x80000000ul))
+    {
+        overflows++;
+    }
+
+    return (uint32_t)(((((uint64_t)overflows) << 32) | cycles) / (SYSTEM_PERIPHERAL_CLOCK / 1000000));
+}
+
+/*********************************************************************
+ * Function: uint32_t TIMER_GetTickMicros(void)
+ *
+ * Overview: Reads the tick length set by TIMER_SetConfiguration().
+ *
+ * PreCondition: None
+ *
+ * Input:  None
+ *
+ * Output: uint32_t - microseconds per tick, 0 if not configured
+ *
+ ********************************************************************/
+uint32_t TIMER_GetTickMicros(void)
+{
+    if(configured == false)
+    {
+        return 0;
+    }
+
+    return (tick_cycles + (SYSTEM_PERIPHERAL_CLOCK / 2000000)) / (SYSTEM_PERIPHERAL_CLOCK / 1000000);
+}
+
+/****************************************************************************
+  Function:
+    void __attribute__((__interrupt__, auto_psv)) _T5Interrupt(void)
+
+  Description:
+    Extends the 32-bit timestamp counter for TIMER_GetMicros().
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+void __attribute__((__interrupt__, auto_psv)) _T5Interrupt( void )
+{
+    timestamp_overflows++;
+    IFS1bits.T5IF = 0;
+}
+
+/*********************************************************************
+ * Function: static void TIMER_Call(uint8_t index,
+ *                                  const TICK_CALL *call,
+ *                                  uint32_t due)
+ *
+ * Overview: Calls a request's function and, with TIMER_ENABLE_STATS,
+ *           records its cost and lateness.
+ *
+ * PreCondition: None
+ *
+ * Input:  index - the request being serviced
+ *         call - the function to call
+ *         due - timestamp at which the request was due (statistics only)
+ *
+ * Output: None
+ *
+ ********************************************************************/
+static void TIMER_Call(uint8_t index, const TICK_CALL *call, uint32_t due)
+{
+#if defined(TIMER_ENABLE_STATS)
+    TICK_STATISTICS *record = &statistics[index];
+    uint32_t start = TIMER_GetTicks();
+    uint32_t cycles;
+#endif
+
+    if(call->callback != NULL)
+    {
+        call->callback(call->context);
+    }
+    else if(call->handle != NULL)
+    {
+        call->handle();
+    }
+
+#if defined(TIMER_ENABLE_STATS)
+    cycles = TIMER_GetTicks() - start;
+
+    if((record->count == 0) || (cycles < record->min_cycles))
+    {
+        record->min_cycles = cycles;
+    }
+
+    if(cycles > record->max_cycles)
+    {
+        record->max_cycles = cycles;
+    }
+
+    if((start - due) > record->max_lateness_cycles)
+    {
+        record->max_lateness_cycles = start - due;
+    }
+
+    record->total_cycles += cycles;
+    record->count++;
+#endif
+}
+
+#if defined(TIMER_ENABLE_STATS)
+/*********************************************************************
+ * Function: bool TIMER_GetStats(uint8_t index, TIMER_STATS *stats)
+ *
+ * Overview: Reads the statistics of one client slot.
+ *
+ * PreCondition: Called from main context
+ *
+ * Input:  index - client slot, 0 to TIMER_MAX_1MS_CLIENTS - 1
+ *         stats - where to store the statistics
+ *
+ * Output: bool - true if the slot holds a request, false otherwise or
+ *         if not called from main context
+ *
+ ********************************************************************/
+bool TIMER_GetStats(uint8_t index, TIMER_STATS *stats)
+{
+    TICK_STATISTICS record;
+    int ipl;
+
+    if((index >= TIMER_MAX_1MS_CLIENTS) ||
+       (TIMER_Context() != CONTEXT_MAIN) ||
+       (requests[index].state < REQUEST_PENDING))
+    {
+        return false;
+    }
+
+    /* The record is written by TIMER_Call() from the timer interrupts and,
+     * for deferred requests, from TIMER_Dispatch() in main context, and
+     * cleared by TIMER_Register() from either.  Main context cannot
+     * preempt itself, so masking the timer priority makes the copy
+     * consistent. */
+    SET_AND_SAVE_CPU_IPL(ipl, TIMER_INTERRUPT_PRIORITY);
+    record = statistics[index];
+    stats->handle = requests[index].handle;
+    stats->missed = requests[index].missed;
+    RESTORE_CPU_IPL(ipl);
+
+    stats->count = record.count;
+    stats->min_cycles = record.min_cycles;
+    stats->max_cycles = record.max_cycles;
+    stats->average_cycles = (record.count != 0) ? (uint32_t)(record.total_cycles / record.count) : 0;
+    stats->max_lateness_cycles = record.max_lateness_cycles;
+
+    return true;
+}
+#endif
@@ -17,13 +17,16 @@
 #include "bsp/buttons.h"
 #include "bsp/leds.h"
 #include "bsp/lcd.h"
+#include "bsp/scheduler.h"
+
+#define TASK_DISPLAY 0
 
 static void TimerEventHandler( void );
+static void DisplayTask( void );
+static void PotThresholdHandler( ADC_CHANNEL channel, ADC_ZONE zone, uint16_t value );
 
 
 int main(void) {
-    uint16_t pot, temp;
-    
     /*Enable as Leds 10 and 3*/
     LED_Enable ( LED_D10 );
     LED_Enable ( LED_D3 );
@@ -35,33 +38,79 @@ int main(void) {
     TIMER_SetConfiguration ( TIMER_CONFIGURATION_1MS );
     TIMER_RequestTick( &TimerEventHandler, 1000 );
     
-    /*Initiate AD*/
-    ADC_SetConfiguration ( ADC_CONFIGURATION_DEFAULT );
+    /*Initiate AD: the channels are scanned in hardware, so reads do not block*/
+    ADC_SetConfiguration ( ADC_CONFIGURATION_SCAN );
     ADC_ChannelEnable ( ADC_CHANNEL_POTENTIOMETER );
     ADC_ChannelEnable ( ADC_CHANNEL_TEMPERATURE_SENSOR );
     
+    /*Filter in the ADC interrupt: the median drops pot spikes, the average smooths the slow temperature*/
+    ADC_SetFilter ( ADC_CHANNEL_POTENTIOMETER, ADC_FILTER_MEDIAN, 5 );
+    ADC_SetFilter ( ADC_CHANNEL_TEMPERATURE_SENSOR, ADC_FILTER_MOVING_AVERAGE, 16 );
+    
+    /*LED D3 follows the pot around half scale, switched only when it crosses*/
+    ADC_SetThreshold ( ADC_CHANNEL_POTENTIOMETER, 512, 512, &PotThresholdHandler );
+    
     /*Initiate LCD*/
     LCD_Initialize ( ) ;
     
     /* Clear the screen */
     printf( "\f" );  
     
-    while(1){
-        pot = ADC_Read10bit( ADC_CHANNEL_POTENTIOMETER );
-        temp = ADC_Read10bit( ADC_CHANNEL_TEMPERATURE_SENSOR );
+    /* Refresh the readings every 100ms instead of continuously. */
+    SCHEDULER_TaskCreate( TASK_DISPLAY, &DisplayTask );
+    SCHEDULER_PostEvery( TASK_DISPLAY, 100 );
+    
+    SCHEDULER_Run();
+}
+
+static void DisplayTask(void)
+{
+    uint16_t pot;
+    int16_t temp;
+    bool negative;
+    char whole[6];
+
+    pot = ADC_ReadFiltered( ADC_CHANNEL_POTENTIOMETER );
+    temp = ADC_ToTemperature( ADC_ReadFiltered( ADC_CHANNEL_TEMPERATURE_SENSOR ) );
 
-        printf("Embedded SYS Lab\r\nP=%4d T=%4d\r\n", pot, temp);
+    printf("Embedded SYS Lab\r\n");
 
-        if(pot > 512)
-        {
-            LED_On( LED_D3 );
-        }
-        else
-        {
-            LED_Off( LED_D3 );
-        }
+    /* The filters read 0xFFFF until they have a sample. */
+    if( pot == 0xFFFF )
+    {
+        printf("P=---- ");
+    }
+    else
+    {
+        printf("P=%4u ", pot);
+    }
+
+    if( temp == ADC_TEMPERATURE_INVALID )
+    {
+        printf("T= --.-C\r\n");
+    }
+    else
+    {
+        /* Hundredths of a degree, shown to a tenth.  The sign is added
+         * on its own, as the whole degrees of -0.5C are 0. */
+        temp = temp / 10;
+        negative = ( temp < 0 );
+        temp = abs( temp );
+        snprintf(whole, sizeof(whole), "%s%d", negative ? "-" : "", temp / 10);
+        printf("T=%3s.%dC\r\n", whole, temp % 10);
+    }
+}
+
+static void PotThresholdHandler( ADC_CHANNEL channel, ADC_ZONE zone, uint16_t value )
+{
+    if(zone == ADC_ZONE_ABOVE)
+    {
+        LED_On( LED_D3 );
+    }
+    else
+    {
+        LED_Off( LED_D3 );
     }
-        
 }
 
 static void TimerEventHandler(void)
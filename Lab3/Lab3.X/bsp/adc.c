@@ -18,14 +18,302 @@ limitations under the License.
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "adc.h"
 
+#ifndef SYSTEM_PERIPHERAL_CLOCK
+#define SYSTEM_PERIPHERAL_CLOCK 16000000
+#pragma message "This module requires a definition for the peripheral clock frequency.  Assuming 16MHz Fcy (32MHz Fosc).  Define value if this is not correct."
+#endif
+
 #define PIN_ANALOG      1
 #define PIN_DIGITAL     0
 
 #define PIN_INPUT       1
 #define PIN_OUTPUT      0
+
+/* Compiler checks and configuration *******************************/
+/* Samples kept per channel in scan mode.  Two is a double buffer: the
+ * interrupt fills one slot while the other holds the newest sample. */
+#ifndef ADC_SCAN_RING_SIZE
+    #define ADC_SCAN_RING_SIZE 2
+#endif
+
+#if ((ADC_SCAN_RING_SIZE < 2) || (ADC_SCAN_RING_SIZE > 256) || ((ADC_SCAN_RING_SIZE & (ADC_SCAN_RING_SIZE - 1)) != 0))
+    #error "ADC_SCAN_RING_SIZE must be a power of two from 2 to 256."
+#endif
+
+/* Conversion trigger source code for Timer1 in AD1CON1<SSRC>.  Check it
+ * against the data sheet when porting to another device. */
+#ifndef ADC_SSRC_TIMER1
+    #define ADC_SSRC_TIMER1 0b0101
+#endif
+
+/* Shortest conversion clock period (TAD) the ADC accepts, in ns. */
+#ifndef ADC_TAD_MIN_NS
+    #define ADC_TAD_MIN_NS 278
+#endif
+
+/* Acquisition time the sample and hold needs to settle, in ns.  Raise it
+ * for sources with a high output impedance. */
+#ifndef ADC_ACQUISITION_NS
+    #define ADC_ACQUISITION_NS 1000
+#endif
+
+/* Conversions summed into each result of ADC_CONFIGURATION_OVERSAMPLE.
+ * 4 gives 13-bit and 16 gives 14-bit results.  Every conversion lands in
+ * its own result buffer, so the count is limited by the buffer depth. */
+#ifndef ADC_OVERSAMPLE_COUNT
+    #define ADC_OVERSAMPLE_COUNT 16
+#endif
+
+#if (ADC_OVERSAMPLE_COUNT == 4)
+    #define ADC_OVERSAMPLE_BITS 1
+#elif (ADC_OVERSAMPLE_COUNT == 16)
+    #define ADC_OVERSAMPLE_BITS 2
+#else
+    #error "ADC_OVERSAMPLE_COUNT must be 4 or 16."
+#endif
+
+/* History kept per channel for the moving average filter.  A power of
+ * two, so the mean is a shift, and at least 8, which also covers the 5
+ * samples of the median filter. */
+#ifndef ADC_FILTER_MAX_TAPS
+    #define ADC_FILTER_MAX_TAPS 16
+#endif
+
+#if ((ADC_FILTER_MAX_TAPS < 8) || (ADC_FILTER_MAX_TAPS > 64) || ((ADC_FILTER_MAX_TAPS & (ADC_FILTER_MAX_TAPS - 1)) != 0))
+    #error "ADC_FILTER_MAX_TAPS must be a power of two from 8 to 64."
+#endif
+
+/* Distance past a window edge, in result counts, before a channel is
+ * taken to have left its zone. */
+#ifndef ADC_THRESHOLD_HYSTERESIS
+    #define ADC_THRESHOLD_HYSTERESIS 8
+#endif
+
+/* Temperature sensor and reference, for the conversion table.  The
+ * defaults are the TC1047A of the Explorer 16/32, 500mV at 0C rising
+ * 10mV per degree, against the 3.3V AVDD reference. */
+#ifndef ADC_REFERENCE_MV
+    #define ADC_REFERENCE_MV 3300
+#endif
+
+#ifndef ADC_TEMPERATURE_OFFSET_MV
+    #define ADC_TEMPERATURE_OFFSET_MV 500
+#endif
+
+#ifndef ADC_TEMPERATURE_SLOPE_UV
+    #define ADC_TEMPERATURE_SLOPE_UV 10000
+#endif
+
+/* Define the program memory address of a word holding the board's
+ * temperature offset, in hundredths of a degree, to use it.  The word is
+ * not part of the image: it is programmed per board, and left erased
+ * (0xFFFF) means no offset. */
+/* #define ADC_TEMPERATURE_CALIBRATION_ADDRESS 0x... */
+
+/* Sample rate used until ADC_SetSampleRate() is called. */
+#ifndef ADC_DEFAULT_SAMPLE_RATE
+    #define ADC_DEFAULT_SAMPLE_RATE 1000
+#endif
+
+/* Definitions *****************************************************/
+#define ADC_INTERRUPT_PRIORITY  2
+#define ADC_SSRC_AUTO_CONVERT   0b0111
+
+/* ADC timing, worked out from the clock at compile time.  ADCS is the
+ * smallest divider giving TAD = (ADCS + 1) Tcy >= ADC_TAD_MIN_NS and SAMC
+ * the fewest TAD covering ADC_ACQUISITION_NS.  At 16MHz Fcy that is a
+ * 312ns TAD and 4 TAD of sampling, 5us per conversion with the 12 TAD of
+ * a 10-bit conversion (5.6us with the 14 TAD of a 12-bit one). */
+#define ADC_CONVERSION_TAD      12
+#define ADC_CONVERSION_TAD_12BIT 14
+#define ADC_ADCS                (((((SYSTEM_PERIPHERAL_CLOCK / 1000ul) * ADC_TAD_MIN_NS) + 999999ul) / 1000000ul) - 1)
+#define ADC_TAD_NS              (((ADC_ADCS + 1) * 1000000000ull) / SYSTEM_PERIPHERAL_CLOCK)
+#define ADC_SAMC_CALC           ((ADC_ACQUISITION_NS + ADC_TAD_NS - 1) / ADC_TAD_NS)
+#define ADC_SAMC                ((ADC_SAMC_CALC < 1) ? 1 : ADC_SAMC_CALC)
+
+#if (ADC_ADCS > 255)
+    #error "The peripheral clock is too fast to reach ADC_TAD_MIN_NS with the ADC clock divider."
+#endif
+
+#if (ADC_SAMC > 31)
+    #error "ADC_ACQUISITION_NS is longer than 31 TAD of auto-sample time."
+#endif
+
+/* Fastest conversion rate with the auto-sample time kept between
+ * conversions. */
+#define ADC_TIMED_MAX_CONVERSIONS (SYSTEM_PERIPHERAL_CLOCK / ((ADC_ADCS + 1ul) * (ADC_CONVERSION_TAD + ADC_SAMC)))
+
+#define TIMER_ON                0x8000
+#define TIMER_PRESCALER_1       0x0000
+#define TIMER_PRESCALER_8       0x0010
+#define TIMER_PRESCALER_64      0x0020
+#define TIMER_PRESCALER_256     0x0030
+
+#define ADC_FILTER_Q15_ONE      32768l
+#define ADC_FILTER_Q15_HALF     16384l
+
+/* Temperature in hundredths of a degree at a 16-bit left justified
+ * result x, rounded to nearest.  Expanded for every 256th x to build the
+ * table, so there are 257 entries with the full scale end. */
+#define ADC_TEMPERATURE_NUMERATOR(x)  (((long long)(x) * ADC_REFERENCE_MV * 100000ll) - (ADC_TEMPERATURE_OFFSET_MV * 100000ll * 65536ll))
+#define ADC_TEMPERATURE_DENOMINATOR   (65536ll * ADC_TEMPERATURE_SLOPE_UV)
+#define ADC_TEMPERATURE_CENTI(x)      ((int16_t)((ADC_TEMPERATURE_NUMERATOR(x) >= 0) ? \
+                                          ((ADC_TEMPERATURE_NUMERATOR(x) + (ADC_TEMPERATURE_DENOMINATOR / 2)) / ADC_TEMPERATURE_DENOMINATOR) : \
+                                          ((ADC_TEMPERATURE_NUMERATOR(x) - (ADC_TEMPERATURE_DENOMINATOR / 2)) / ADC_TEMPERATURE_DENOMINATOR)))
+
+#define ADC_TEMPERATURE_1(i)    ADC_TEMPERATURE_CENTI((i) * 256ul)
+#define ADC_TEMPERATURE_4(i)    ADC_TEMPERATURE_1(i), ADC_TEMPERATURE_1((i) + 1), ADC_TEMPERATURE_1((i) + 2), ADC_TEMPERATURE_1((i) + 3)
+#define ADC_TEMPERATURE_16(i)   ADC_TEMPERATURE_4(i), ADC_TEMPERATURE_4((i) + 4), ADC_TEMPERATURE_4((i) + 8), ADC_TEMPERATURE_4((i) + 12)
+#define ADC_TEMPERATURE_64(i)   ADC_TEMPERATURE_16(i), ADC_TEMPERATURE_16((i) + 16), ADC_TEMPERATURE_16((i) + 32), ADC_TEMPERATURE_16((i) + 48)
+#define ADC_TEMPERATURE_256(i)  ADC_TEMPERATURE_64(i), ADC_TEMPERATURE_64((i) + 64), ADC_TEMPERATURE_64((i) + 128), ADC_TEMPERATURE_64((i) + 192)
+
+#if (((ADC_REFERENCE_MV - ADC_TEMPERATURE_OFFSET_MV) * 100000ll / ADC_TEMPERATURE_SLOPE_UV) > 32767) || ((ADC_TEMPERATURE_OFFSET_MV * 100000ll / ADC_TEMPERATURE_SLOPE_UV) > 32767)
+    #error "The temperature range of the sensor does not fit hundredths of a degree in 16 bits."
+#endif
+
+#define ADC_CALIBRATION_ERASED  ((int16_t)0xFFFF)
+
+#define ADC_EXPORT_SYNC_1       0xA5
+#define ADC_EXPORT_SYNC_2       0x5A
+
+#define ADC_SCAN_RING_MASK      (ADC_SCAN_RING_SIZE - 1)
+#define ADC_ZONE_NONE           0xFF
+
+/* Type Definitions ************************************************/
+/* Filter state of one channel.  Written by ADC_SetFilter() with the ADC
+ * interrupt masked, and otherwise by the interrupt only. */
+typedef struct
+{
+    ADC_FILTER_TYPE type;
+    /* Taps of the average or median, coefficient of the IIR. */
+    uint16_t parameter;
+    /* log2 of the taps of the average. */
+    uint8_t shift;
+    /* false until the first sample, which seeds the history. */
+    volatile bool primed;
+    uint8_t index;
+    uint16_t history[ADC_FILTER_MAX_TAPS];
+    uint32_t sum;
+    /* IIR output in Q15. */
+    int32_t state;
+    volatile uint16_t output;
+} ADC_FILTER;
+
+/* Window of one channel, see ADC_SetThreshold().  Written with the ADC
+ * interrupt masked. */
+typedef struct
+{
+    ADC_THRESHOLD_CALLBACK callback;
+    uint16_t low;
+    uint16_t high;
+    /* ADC_ZONE, or ADC_ZONE_NONE until the first sample. */
+    uint8_t zone;
+} ADC_THRESHOLD;
+
+/* Where an ADC_CHANNEL is on the device and the board. */
+typedef struct
+{
+    /* Analog input: the AD1CHS value, the scan select bit and, when
+     * scanning, the result buffer. */
+    uint8_t input;
+    /* Analog select register and bit of the pin. */
+    volatile uint16_t *ansel;
+    uint16_t ansel_mask;
+} ADC_CHANNEL_DESCRIPTOR;
+
+#if defined(ADC_ENABLE_STATISTICS)
+/* Running statistics of one channel.  Written by the ADC interrupt, and
+ * by the main context only with it masked. */
+typedef struct
+{
+    uint16_t count;
+    uint16_t min;
+    uint16_t max;
+    /* Mean in Q16. */
+    int32_t mean;
+    /* Sum of squared differences from the mean, in Q16. */
+    int64_t m2;
+} ADC_ACCUMULATOR;
+#endif
+
+/* Variables *******************************************************/
+static const ADC_CHANNEL_DESCRIPTOR channels[ADC_CHANNEL_COUNT] =
+{
+    [ADC_CHANNEL_5]  = {  5, &ANSB, (1 << 5) },
+    [ADC_CHANNEL_4]  = {  4, &ANSB, (1 << 4) },
+    [ADC_CHANNEL_10] = { 10, &ANSB, (1 << 10) },
+    [ADC_CHANNEL_1]  = {  1, &ANSB, (1 << 1) }
+};
+
+/* Read through the PSV window, so the table costs no RAM. */
+static const __psv__ int16_t temperature_table[257] __attribute__((space(psv))) =
+{
+    ADC_TEMPERATURE_256(0),
+    ADC_TEMPERATURE_1(256)
+};
+
+#if defined(ADC_TEMPERATURE_CALIBRATION_ADDRESS)
+static const __psv__ int16_t temperature_calibration __attribute__((space(psv), address(ADC_TEMPERATURE_CALIBRATION_ADDRESS), noload));
+#endif
+
+/* Single conversion state of the default configuration. */
+static volatile bool conversion_busy = false;
+static volatile bool conversion_ready = false;
+static volatile uint16_t conversion_result;
+static uint8_t resolution = 10;
+static bool oversampling = false;
+static ADC_CHANNEL conversion_channel;
+static ADC_CALLBACK conversion_callback;
+static void *conversion_context;
+
+/* Burst capture.  capturing holds the ADC from ADC_CaptureBurst() until
+ * the next ADC_SetConfiguration(); capture_done is set by the interrupt
+ * after the last sample. */
+static bool capturing = false;
+static uint16_t *capture_buffer;
+static uint16_t capture_count;
+static volatile uint16_t capture_index;
+static volatile bool capture_done;
+static uint8_t capture_resolution;
+static ADC_CHANNEL capture_channel;
+static ADC_CAPTURE_CALLBACK capture_callback;
+static void *capture_context;
+
+static uint16_t enabled_channels;
+static uint8_t enabled_count;
+static bool scanning = false;
+static bool timed = false;
+static uint32_t sample_rate = ADC_DEFAULT_SAMPLE_RATE;
+
+static ADC_FILTER filters[ADC_CHANNEL_COUNT];
+static ADC_THRESHOLD thresholds[ADC_CHANNEL_COUNT];
+#if defined(ADC_ENABLE_STATISTICS)
+static ADC_ACCUMULATOR accumulators[ADC_CHANNEL_COUNT];
+#endif
+
+/* Written by the ADC interrupt only.  scan_head is published after the
+ * samples it points at, so a reader always sees a complete slot. */
+static volatile uint16_t scan_ring[ADC_CHANNEL_COUNT][ADC_SCAN_RING_SIZE];
+static volatile uint8_t scan_head;
+static volatile uint16_t scan_count;
+
+/* Private Functions ***********************************************/
+static bool ADC_IsEnabled(ADC_CHANNEL channel);
+static bool ADC_ExportWord(ADC_EXPORT_PUTC put, uint16_t word);
+static void ADC_ScanStart(void);
+static bool ADC_TimerStart(uint32_t rate);
+static uint16_t ADC_Decimate(void);
+static void ADC_Filter(ADC_CHANNEL channel, uint16_t sample);
+static uint16_t ADC_Median(ADC_FILTER *filter);
+static void ADC_Compare(ADC_CHANNEL channel);
+#if defined(ADC_ENABLE_STATISTICS)
+static void ADC_Accumulate(ADC_CHANNEL channel, uint16_t sample);
+#endif
+
 /*********************************************************************
 * Function: ADC_ReadPercentage(ADC_CHANNEL channel);
 *
@@ -46,28 +334,15 @@ limitations under the License.
 ********************************************************************/
 uint8_t ADC_ReadPercentage( ADC_CHANNEL channel )
 {
-    uint8_t percent;
+    uint16_t result = ADC_Read(channel);
 
-    switch(channel)
+    if(result == 0xFFFF)
     {
-        case ADC_CHANNEL_5:
-            break;
-      
-        case ADC_CHANNEL_4:
-            break ;
-
-        default:
-            return 0xFF;
+        return 0xFF;
     }
-    
-    //A very crude percentage calculation
-    percent = (ADC_Read10bit(channel) / 10);
 
-    if(percent > 100)
-    {
-        percent = 100;
-    }
-    return percent;
+    /* Full scale is 100%, rounded to nearest. */
+    return (uint8_t)((((uint32_t)result * 200) + ((1ul << resolution) - 1)) / (((1ul << resolution) - 1) * 2));
 }
 
 /*********************************************************************
@@ -90,38 +365,69 @@ uint8_t ADC_ReadPercentage( ADC_CHANNEL channel )
 ********************************************************************/
 uint16_t ADC_Read10bit(ADC_CHANNEL channel)
 {
-    uint16_t i;
-    
-    switch(channel)
+    uint16_t result = ADC_Read(channel);
+
+    if(result == 0xFFFF)
     {
-        case ADC_CHANNEL_5:
-            break;
+        return 0xFFFF;
+    }
 
-        case ADC_CHANNEL_4:
-            break ;
+    return result >> (resolution - 10);
+}
 
-        default:
-            return 0xFFFF;
+/*********************************************************************
+* Function: ADC_Read(ADC_CHANNEL channel);
+*
+* Overview: Reads the requested ADC channel at the resolution of the
+*           configuration.
+*
+* PreCondition: channel is enabled via ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to read
+*
+* Output: uint16_t the right adjusted result or 0xFFFF for an error.
+*
+********************************************************************/
+uint16_t ADC_Read(ADC_CHANNEL channel)
+{
+    if(ADC_IsEnabled(channel) == false)
+    {
+        return 0xFFFF;
     }
 
-    AD1CHS = channel ;
-
-    // Get an ADC sample
-    AD1CON1bits.SAMP = 1;           //Start sampling
-    for(i=0;i<1000;i++)
+    if(scanning == true)
     {
-        Nop(); //Sample delay, conversion start automatically
-    } 
+        /* Only waits for the first scan after configuration. */
+        while(scan_count == 0);
+
+        return ADC_ReadLatest(channel);
+    }
 
-    AD1CON1bits.SAMP = 0;           //Start sampling
-    for(i=0;i<1000;i++)
+    if(ADC_Start(channel) == false)
     {
-        Nop(); //Sample delay, conversion start automatically
+        return 0xFFFF;
     }
 
-    while(!AD1CON1bits.DONE);       //Wait for conversion to complete
+    while(ADC_IsReady() == false);  //Wait for conversion to complete
 
-    return ADC1BUF0;
+    return ADC_GetResult();
+}
+
+/*********************************************************************
+* Function: uint8_t ADC_GetResolution(void);
+*
+* Overview: Returns the width of the results of the configuration.
+*
+* PreCondition: ADC_SetConfiguration() called
+*
+* Input: None
+*
+* Output: uint8_t - result width in bits
+*
+********************************************************************/
+uint8_t ADC_GetResolution(void)
+{
+    return resolution;
 }
 
 /*********************************************************************
@@ -139,20 +445,21 @@ uint16_t ADC_Read10bit(ADC_CHANNEL channel)
 ********************************************************************/
 bool ADC_ChannelEnable(ADC_CHANNEL channel)
 {
-    switch(channel)
+    if(channel >= ADC_CHANNEL_COUNT)
     {
-        case ADC_CHANNEL_5:
-            ANSBbits.ANSB5 = PIN_ANALOG ;
+        return false;
+    }
 
-        case ADC_CHANNEL_4:
-            ANSBbits.ANSB4 = PIN_ANALOG ;
-            return true ;
+    *channels[channel].ansel |= channels[channel].ansel_mask;
+    enabled_channels |= (1 << channel);
 
-        default:
-            return false;
+    /* A running scan picks the channel up when it restarts. */
+    if(scanning == true)
+    {
+        ADC_ScanStart();
     }
-    
-    return false;
+
+    return true;
 }
 
 /*********************************************************************
@@ -169,17 +476,1274 @@ bool ADC_ChannelEnable(ADC_CHANNEL channel)
 ********************************************************************/
 bool ADC_SetConfiguration(ADC_CONFIGURATION configuration)
 {
-    if(configuration == ADC_CONFIGURATION_DEFAULT)
+    if((configuration == ADC_CONFIGURATION_DEFAULT) ||
+       (configuration == ADC_CONFIGURATION_12BIT) ||
+       (configuration == ADC_CONFIGURATION_OVERSAMPLE))
     {
+        IEC0bits.AD1IE = 0;
+        T1CONbits.TON = 0;
+        scanning = false;
+        timed = false;
+        capturing = false;
+
+        AD1CON1bits.ADON = 0;
+        AD1CON1bits.ASAM = 0;
+        AD1CON2bits.CSCNA = 0;
+        AD1CON2bits.BUFREGEN = 0;
+
         AD1CON2bits.PVCFG = 0x0 ;
-        AD1CON3bits.ADCS = 0xFF ;
-        AD1CON1bits.SSRC = 0x0;
-        AD1CON3bits.SAMC = 0b10000;
+        AD1CON3bits.ADRC = 0;           //TAD derived from Tcy
+        AD1CON3bits.ADCS = ADC_ADCS ;
+        /* Setting SAMP starts sampling, the internal counter ends it
+         * after SAMC TAD and starts the conversion. */
+        AD1CON1bits.SSRC = ADC_SSRC_AUTO_CONVERT;
+        AD1CON3bits.SAMC = ADC_SAMC;
         AD1CON1bits.FORM = 0b00;
-        AD1CON2bits.SMPI = 0x0;
+
+        if(configuration == ADC_CONFIGURATION_DEFAULT)
+        {
+            AD1CON1bits.MODE12 = 0;
+            resolution = 10;
+        }
+        else
+        {
+            AD1CON1bits.MODE12 = 1;
+            resolution = 12;
+        }
+
+        /* When oversampling the conversions fill ADC1BUF0 onwards and
+         * interrupt once the last one is stored. */
+        oversampling = (configuration == ADC_CONFIGURATION_OVERSAMPLE);
+
+        if(oversampling == true)
+        {
+            AD1CON2bits.SMPI = ADC_OVERSAMPLE_COUNT - 1;
+            resolution += ADC_OVERSAMPLE_BITS;
+        }
+        else
+        {
+            AD1CON2bits.SMPI = 0x0;
+        }
+
+        conversion_busy = false;
+        conversion_ready = false;
+
+        IPC3bits.AD1IP = ADC_INTERRUPT_PRIORITY;
+        IFS0bits.AD1IF = 0;
+        IEC0bits.AD1IE = 1;
+
         AD1CON1bits.ADON = 1;
         return true;
     }
+
+    if((configuration == ADC_CONFIGURATION_SCAN) || (configuration == ADC_CONFIGURATION_TIMED))
+    {
+        IEC0bits.AD1IE = 0;
+        AD1CON1bits.ADON = 0;
+
+        timed = (configuration == ADC_CONFIGURATION_TIMED);
+        capturing = false;
+        oversampling = false;
+        resolution = 10;
+
+        AD1CON2bits.PVCFG = 0x0 ;
+        AD1CON3bits.ADRC = 0;           //TAD derived from Tcy
+        AD1CON3bits.ADCS = ADC_ADCS ;
+        AD1CON3bits.SAMC = ADC_SAMC;
+        AD1CON1bits.FORM = 0b00;
+        AD1CON1bits.MODE12 = 0;
+
+        /* Sampling restarts after each conversion and the internal
+         * counter or a Timer1 match ends it, so the scan runs without
+         * software. */
+        if(timed == true)
+        {
+            AD1CON1bits.SSRC = ADC_SSRC_TIMER1;
+        }
+        else
+        {
+            AD1CON1bits.SSRC = ADC_SSRC_AUTO_CONVERT;
+        }
+        AD1CON1bits.ASAM = 1;
+
+        /* Each result goes to the buffer of its channel number. */
+        AD1CON2bits.CSCNA = 1;
+        AD1CON2bits.BUFREGEN = 1;
+
+        IPC3bits.AD1IP = ADC_INTERRUPT_PRIORITY;
+
+        scanning = true;
+        ADC_ScanStart();
+        return true;
+    }
 		
     return false;
 }
+
+/*********************************************************************
+* Function: uint16_t ADC_ReadLatest(ADC_CHANNEL channel);
+*
+* Overview: Returns the newest sample of a channel stored by the scan
+*           interrupt, without waiting.
+*
+* PreCondition: ADC_CONFIGURATION_SCAN set and channel enabled via
+*               ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to read
+*
+* Output: uint16_t the right adjusted 10-bit sample, or 0xFFFF if no
+*         scan has completed yet or for an error.
+*
+********************************************************************/
+uint16_t ADC_ReadLatest(ADC_CHANNEL channel)
+{
+    if((ADC_IsEnabled(channel) == false) || (scan_count == 0))
+    {
+        return 0xFFFF;
+    }
+
+    return scan_ring[channel][scan_head];
+}
+
+/*********************************************************************
+* Function: bool ADC_Start(ADC_CHANNEL channel);
+*
+* Overview: Starts a single conversion and returns straight away.
+*
+* PreCondition: A single conversion configuration set and channel enabled via
+*               ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to convert
+*
+* Output: bool - true if started, false if the ADC is busy, scanning or
+*         the channel is not valid.
+*
+********************************************************************/
+bool ADC_Start(ADC_CHANNEL channel)
+{
+    return ADC_StartWithCallback(channel, NULL, NULL);
+}
+
+/*********************************************************************
+* Function: bool ADC_StartWithCallback(ADC_CHANNEL channel,
+*                                      ADC_CALLBACK callback,
+*                                      void *context);
+*
+* Overview: Starts a single conversion and calls back from the ADC
+*           interrupt when it completes.
+*
+* PreCondition: A single conversion configuration set and channel enabled via
+*               ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to convert
+*        ADC_CALLBACK callback - called with the result, may be NULL
+*        void *context - passed to the callback
+*
+* Output: bool - true if started, false if the ADC is busy, scanning or
+*         the channel is not valid.
+*
+********************************************************************/
+bool ADC_StartWithCallback(ADC_CHANNEL channel, ADC_CALLBACK callback, void *context)
+{
+    if((scanning == true) || (capturing == true) || (conversion_busy == true) || (ADC_IsEnabled(channel) == false))
+    {
+        return false;
+    }
+
+    conversion_busy = true;
+    conversion_ready = false;
+    conversion_channel = channel;
+    conversion_callback = callback;
+    conversion_context = context;
+
+    AD1CHS = channels[channel].input;
+
+    if(oversampling == true)
+    {
+        /* Turning the module off and on points the buffer fill back at
+         * ADC1BUF0, then sampling restarts after every conversion until
+         * the interrupt stops it. */
+        AD1CON1bits.ADON = 0;
+        AD1CON1bits.ADON = 1;
+        AD1CON1bits.ASAM = 1;
+    }
+    else
+    {
+        AD1CON1bits.SAMP = 1;
+    }
+
+    return true;
+}
+
+/*********************************************************************
+* Function: bool ADC_IsReady(void);
+*
+* Overview: Tells whether the conversion started last has completed.
+*
+* PreCondition: ADC_Start() called
+*
+* Input: None
+*
+* Output: bool - true if the result is available
+*
+********************************************************************/
+bool ADC_IsReady(void)
+{
+    return conversion_ready;
+}
+
+/*********************************************************************
+* Function: uint16_t ADC_GetResult(void);
+*
+* Overview: Returns the result of the conversion started last.
+*
+* PreCondition: ADC_IsReady() returned true
+*
+* Input: None
+*
+* Output: uint16_t the right adjusted 10-bit result, or 0xFFFF if the
+*         conversion has not completed.
+*
+********************************************************************/
+uint16_t ADC_GetResult(void)
+{
+    if(conversion_ready == false)
+    {
+        return 0xFFFF;
+    }
+
+    return conversion_result;
+}
+
+/*********************************************************************
+* Function: bool ADC_SetSampleRate(uint32_t hz);
+*
+* Overview: Sets the per channel sample rate of the timed configuration.
+*           The rate is checked for the largest scan, so that enabling
+*           more channels later cannot exceed what the ADC converts.
+*
+* PreCondition: none
+*
+* Input: uint32_t hz - samples per second per channel
+*
+* Output: bool - true if the rate can be produced, false otherwise.
+*
+********************************************************************/
+bool ADC_SetSampleRate(uint32_t hz)
+{
+    /* The slowest Timer1 setting is 65536 counts at 1:256. */
+    if((hz == 0) ||
+       (hz > (ADC_TIMED_MAX_CONVERSIONS / ADC_CHANNEL_COUNT)) ||
+       ((SYSTEM_PERIPHERAL_CLOCK / 256ul / hz) > 0x10000ul))
+    {
+        return false;
+    }
+
+    sample_rate = hz;
+
+    if((timed == true) && (enabled_count != 0))
+    {
+        return ADC_TimerStart(sample_rate * enabled_count);
+    }
+
+    return true;
+}
+
+/*********************************************************************
+* Function: bool ADC_CaptureBurst(ADC_CHANNEL channel,
+*                                 uint16_t *buffer,
+*                                 uint16_t count,
+*                                 uint32_t rate);
+*
+* Overview: Converts one channel on every Timer1 match and stores the
+*           results in a buffer from the ADC interrupt.
+*
+* PreCondition: channel enabled via ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to capture
+*        uint16_t *buffer - where to store the samples
+*        uint16_t count - samples to capture
+*        uint32_t rate - samples per second
+*
+* Output: bool - true if the capture started, false otherwise.
+*
+********************************************************************/
+bool ADC_CaptureBurst(ADC_CHANNEL channel, uint16_t *buffer, uint16_t count, uint32_t rate)
+{
+    return ADC_CaptureBurstWithCallback(channel, buffer, count, rate, NULL, NULL);
+}
+
+/*********************************************************************
+* Function: bool ADC_CaptureBurstWithCallback(ADC_CHANNEL channel,
+*                                             uint16_t *buffer,
+*                                             uint16_t count,
+*                                             uint32_t rate,
+*                                             ADC_CAPTURE_CALLBACK callback,
+*                                             void *context);
+*
+* Overview: Converts one channel on every Timer1 match, stores the
+*           results in a buffer from the ADC interrupt and calls back
+*           after the last one.  Every argument is checked before the
+*           current configuration is torn down.
+*
+* PreCondition: channel enabled via ADC_ChannelEnable()
+*
+* Input: ADC_CHANNEL channel - the channel to capture
+*        uint16_t *buffer - where to store the samples
+*        uint16_t count - samples to capture
+*        uint32_t rate - samples per second
+*        ADC_CAPTURE_CALLBACK callback - called on completion, may be NULL
+*        void *context - passed to the callback
+*
+* Output: bool - true if the capture started, false otherwise.
+*
+********************************************************************/
+bool ADC_CaptureBurstWithCallback(ADC_CHANNEL channel, uint16_t *buffer, uint16_t count, uint32_t rate, ADC_CAPTURE_CALLBACK callback, void *context)
+{
+    /* The slowest Timer1 setting is 65536 counts at 1:256. */
+    if((ADC_IsEnabled(channel) == false) || (buffer == NULL) || (count == 0) ||
+       ((capturing == true) && (capture_done == false)) ||
+       (rate == 0) ||
+       (rate > ADC_TIMED_MAX_CONVERSIONS) ||
+       ((SYSTEM_PERIPHERAL_CLOCK / 256ul / rate) > 0x10000ul))
+    {
+        return false;
+    }
+
+    IEC0bits.AD1IE = 0;
+    T1CONbits.TON = 0;
+    AD1CON1bits.ADON = 0;
+
+    scanning = false;
+    timed = false;
+    oversampling = false;
+    conversion_busy = false;
+    resolution = (AD1CON1bits.MODE12 == 1) ? 12 : 10;
+
+    capture_buffer = buffer;
+    capture_resolution = resolution;
+    capture_count = count;
+    capture_index = 0;
+    capture_done = false;
+    capture_channel = channel;
+    capture_callback = callback;
+    capture_context = context;
+    capturing = true;
+
+    AD1CON2bits.PVCFG = 0x0 ;
+    AD1CON3bits.ADRC = 0;           //TAD derived from Tcy
+    AD1CON3bits.ADCS = ADC_ADCS ;
+    AD1CON3bits.SAMC = ADC_SAMC;
+    AD1CON1bits.FORM = 0b00;
+    AD1CON1bits.SSRC = ADC_SSRC_TIMER1;
+    AD1CON2bits.CSCNA = 0;
+    AD1CON2bits.BUFREGEN = 0;
+    AD1CON2bits.SMPI = 0x0;
+    AD1CHS = channels[channel].input;
+
+    IPC3bits.AD1IP = ADC_INTERRUPT_PRIORITY;
+    IFS0bits.AD1IF = 0;
+    IEC0bits.AD1IE = 1;
+
+    AD1CON1bits.ADON = 1;
+    AD1CON1bits.ASAM = 1;
+
+    if(ADC_TimerStart(rate) == false)
+    {
+        IEC0bits.AD1IE = 0;
+        AD1CON1bits.ADON = 0;
+        capturing = false;
+        return false;
+    }
+
+    return true;
+}
+
+/*********************************************************************
+* Function: bool ADC_IsCaptureComplete(void);
+*
+* Overview: Tells whether the burst has been captured.
+*
+* PreCondition: ADC_CaptureBurst() called
+*
+* Input: None
+*
+* Output: bool - true once the last sample is stored
+*
+********************************************************************/
+bool ADC_IsCaptureComplete(void)
+{
+    return (capturing == true) && (capture_done == true);
+}
+
+/*********************************************************************
+* Function: bool ADC_ExportBurst(const uint16_t *buffer,
+*                                uint16_t count,
+*                                ADC_EXPORT_PUTC put);
+*
+* Overview: Writes a frame of samples in binary: 0xA5 0x5A, the count
+*           and the resolution, the samples, then the 16-bit sum of the
+*           samples.  Multi-byte fields are little endian.  Stops at the
+*           first byte put() fails to write, as the receiver could not
+*           resynchronise on a frame with bytes missing from it.  The
+*           buffer of the last burst is labelled with the resolution it
+*           was captured at, any other with the current one.
+*
+* PreCondition: none
+*
+* Input: const uint16_t *buffer - the samples
+*        uint16_t count - number of samples
+*        ADC_EXPORT_PUTC put - writes one byte, e.g. putU2()
+*
+* Output: bool - true if the whole frame was written, false otherwise
+*
+********************************************************************/
+bool ADC_ExportBurst(const uint16_t *buffer, uint16_t count, ADC_EXPORT_PUTC put)
+{
+    uint16_t i;
+    uint16_t sum = 0;
+    uint8_t bits = resolution;
+
+    if(buffer == capture_buffer)
+    {
+        /* Half of a running capture would be exported as a burst. */
+        if((capturing == true) && (capture_done == false))
+        {
+            return false;
+        }
+
+        bits = capture_resolution;
+    }
+
+    if((put(ADC_EXPORT_SYNC_1) == -1) ||
+       (put(ADC_EXPORT_SYNC_2) == -1) ||
+       (ADC_ExportWord(put, count) == false) ||
+       (put(bits) == -1))
+    {
+        return false;
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        if(ADC_ExportWord(put, buffer[i]) == false)
+        {
+            return false;
+        }
+        sum += buffer[i];
+    }
+
+    return ADC_ExportWord(put, sum);
+}
+
+/*********************************************************************
+* Function: static bool ADC_ExportWord(ADC_EXPORT_PUTC put, uint16_t word)
+*
+* Overview: Writes a 16-bit field of an export, little endian.
+*
+* PreCondition: None
+*
+* Input: put - writes one byte
+*        word - the field
+*
+* Output: bool - true if both bytes were written
+*
+********************************************************************/
+static bool ADC_ExportWord(ADC_EXPORT_PUTC put, uint16_t word)
+{
+    return (put(word & 0xFF) != -1) && (put(word >> 8) != -1);
+}
+
+#if defined(ADC_ENABLE_STATISTICS)
+/*********************************************************************
+* Function: bool ADC_GetStatistics(ADC_CHANNEL channel,
+*                                  ADC_STATISTICS *statistics);
+*
+* Overview: Reads the statistics of a channel.  The accumulator is copied
+*           with the ADC interrupt masked and the variance worked out
+*           from the copy, so the division stays out of the interrupt.
+*
+* PreCondition: None
+*
+* Input: ADC_CHANNEL channel - the channel
+*        ADC_STATISTICS *statistics - where to store the figures
+*
+* Output: bool - true if the channel has samples, false otherwise
+*
+********************************************************************/
+bool ADC_GetStatistics(ADC_CHANNEL channel, ADC_STATISTICS *statistics)
+{
+    ADC_ACCUMULATOR copy;
+    int64_t variance;
+    bool interrupt_enabled;
+
+    if((channel >= ADC_CHANNEL_COUNT) || (statistics == NULL))
+    {
+        return false;
+    }
+
+    interrupt_enabled = IEC0bits.AD1IE;
+    IEC0bits.AD1IE = 0;
+    copy = accumulators[channel];
+    IEC0bits.AD1IE = interrupt_enabled;
+
+    if(copy.count == 0)
+    {
+        return false;
+    }
+
+    variance = (copy.m2 / copy.count) >> 8;
+
+    statistics->count = copy.count;
+    statistics->min = copy.min;
+    statistics->max = copy.max;
+    statistics->mean_q8 = (uint32_t)((copy.mean + 0x80) >> 8);
+    /* Rounding in the updates can leave a flat signal slightly below 0. */
+    statistics->variance_q8 = (variance < 0) ? 0 : (uint64_t)variance;
+
+    return true;
+}
+
+/*********************************************************************
+* Function: void ADC_ResetStatistics(ADC_CHANNEL channel);
+*
+* Overview: Starts a new statistics window for a channel.
+*
+* PreCondition: None
+*
+* Input: ADC_CHANNEL channel - the channel
+*
+* Output: None
+*
+********************************************************************/
+void ADC_ResetStatistics(ADC_CHANNEL channel)
+{
+    bool interrupt_enabled;
+
+    if(channel >= ADC_CHANNEL_COUNT)
+    {
+        return;
+    }
+
+    interrupt_enabled = IEC0bits.AD1IE;
+    IEC0bits.AD1IE = 0;
+    accumulators[channel].count = 0;
+    accumulators[channel].mean = 0;
+    accumulators[channel].m2 = 0;
+    IEC0bits.AD1IE = interrupt_enabled;
+}
+#endif
+
+/*********************************************************************
+* Function: bool ADC_SetFilter(ADC_CHANNEL channel,
+*                              ADC_FILTER_TYPE type,
+*                              uint16_t parameter);
+*
+* Overview: Selects the filter of a channel.
+*
+* PreCondition: none
+*
+* Input: ADC_CHANNEL channel - the channel to filter
+*        ADC_FILTER_TYPE type - the filter
+*        uint16_t parameter - taps or coefficient, see ADC_FILTER_TYPE
+*
+* Output: bool - true if set, false if the channel or parameter is not
+*         valid.
+*
+********************************************************************/
+bool ADC_SetFilter(ADC_CHANNEL channel, ADC_FILTER_TYPE type, uint16_t parameter)
+{
+    uint8_t shift = 0;
+    bool interrupt_enabled;
+
+    if(channel >= ADC_CHANNEL_COUNT)
+    {
+        return false;
+    }
+
+    switch(type)
+    {
+        case ADC_FILTER_NONE:
+            break;
+
+        case ADC_FILTER_MOVING_AVERAGE:
+            if((parameter < 2) || (parameter > ADC_FILTER_MAX_TAPS) || ((parameter & (parameter - 1)) != 0))
+            {
+                return false;
+            }
+
+            while((1u << shift) < parameter)
+            {
+                shift++;
+            }
+            break;
+
+        case ADC_FILTER_IIR:
+            if((parameter == 0) || (parameter >= ADC_FILTER_Q15_ONE))
+            {
+                return false;
+            }
+            break;
+
+        case ADC_FILTER_MEDIAN:
+            if((parameter != 3) && (parameter != 5))
+            {
+                return false;
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    interrupt_enabled = IEC0bits.AD1IE;
+    IEC0bits.AD1IE = 0;
+
+    filters[channel].type = type;
+    filters[channel].parameter = parameter;
+    filters[channel].shift = shift;
+    filters[channel].primed = false;
+
+    IEC0bits.AD1IE = interrupt_enabled;
+
+    return true;
+}
+
+/*********************************************************************
+* Function: uint16_t ADC_ReadFiltered(ADC_CHANNEL channel);
+*
+* Overview: Returns the filter output for the newest sample of a
+*           channel.
+*
+* PreCondition: ADC_SetFilter() called for the channel
+*
+* Input: ADC_CHANNEL channel - the channel to read
+*
+* Output: uint16_t the filtered value, or 0xFFFF if the channel has no
+*         sample yet or for an error.
+*
+********************************************************************/
+uint16_t ADC_ReadFiltered(ADC_CHANNEL channel)
+{
+    if((channel >= ADC_CHANNEL_COUNT) || (filters[channel].primed == false))
+    {
+        return 0xFFFF;
+    }
+
+    return filters[channel].output;
+}
+
+/*********************************************************************
+* Function: bool ADC_SetThreshold(ADC_CHANNEL channel,
+*                                 uint16_t low,
+*                                 uint16_t high,
+*                                 ADC_THRESHOLD_CALLBACK callback);
+*
+* Overview: Sets the window a channel is watched against.
+*
+* PreCondition: none
+*
+* Input: ADC_CHANNEL channel - the channel to watch
+*        uint16_t low - lower edge of the window
+*        uint16_t high - upper edge of the window
+*        ADC_THRESHOLD_CALLBACK callback - called on crossings, or NULL
+*
+* Output: bool - true if set, false if the channel is not valid or low
+*         is above high.
+*
+********************************************************************/
+bool ADC_SetThreshold(ADC_CHANNEL channel, uint16_t low, uint16_t high, ADC_THRESHOLD_CALLBACK callback)
+{
+    bool interrupt_enabled;
+
+    if((channel >= ADC_CHANNEL_COUNT) || (low > high))
+    {
+        return false;
+    }
+
+    interrupt_enabled = IEC0bits.AD1IE;
+    IEC0bits.AD1IE = 0;
+
+    thresholds[channel].callback = callback;
+    thresholds[channel].low = low;
+    thresholds[channel].high = high;
+    thresholds[channel].zone = ADC_ZONE_NONE;
+
+    IEC0bits.AD1IE = interrupt_enabled;
+
+    return true;
+}
+
+/*********************************************************************
+* Function: int16_t ADC_ToTemperature(uint16_t counts);
+*
+* Overview: Converts a temperature sensor result to temperature.  The
+*           counts are left justified to 16 bits; the top byte picks the
+*           table entry and the low byte interpolates towards the next.
+*
+* PreCondition: ADC_SetConfiguration() called
+*
+* Input: uint16_t counts - a temperature sensor result
+*
+* Output: int16_t - hundredths of a degree Celsius, or
+*         ADC_TEMPERATURE_INVALID
+*
+********************************************************************/
+int16_t ADC_ToTemperature(uint16_t counts)
+{
+    uint16_t x;
+    uint8_t index;
+    uint8_t fraction;
+    int16_t low;
+    int16_t temperature;
+#if defined(ADC_TEMPERATURE_CALIBRATION_ADDRESS)
+    int16_t offset;
+#endif
+
+    if(counts == 0xFFFF)
+    {
+        return ADC_TEMPERATURE_INVALID;
+    }
+
+    x = counts << (16 - resolution);
+    index = x >> 8;
+    fraction = x & 0xFF;
+
+    low = temperature_table[index];
+    temperature = low + (int16_t)(((int32_t)(temperature_table[index + 1] - low) * fraction) >> 8);
+
+#if defined(ADC_TEMPERATURE_CALIBRATION_ADDRESS)
+    offset = temperature_calibration;
+
+    if(offset != ADC_CALIBRATION_ERASED)
+    {
+        temperature += offset;
+    }
+#endif
+
+    return temperature;
+}
+
+/*********************************************************************
+* Function: uint16_t ADC_GetScanCount(void);
+*
+* Overview: Returns the number of scans completed since the scan was
+*           configured.
+*
+* PreCondition: ADC_CONFIGURATION_SCAN set
+*
+* Input: None
+*
+* Output: uint16_t - completed scans, wrapping at 0xFFFF
+*
+********************************************************************/
+uint16_t ADC_GetScanCount(void)
+{
+    return scan_count;
+}
+
+/****************************************************************************
+  Function:
+    void __attribute__((__interrupt__, auto_psv)) _ADC1Interrupt(void)
+
+  Description:
+    ADC interrupt.  When scanning it is raised once per scan of the enabled
+    channels; it copies the results into the next ring slot of each channel
+    and then publishes that slot as the newest.  During a burst capture it
+    stores one sample per interrupt.  Otherwise it completes the single
+    conversion started by ADC_Start().
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+void __attribute__((__interrupt__, auto_psv)) _ADC1Interrupt( void )
+{
+    uint8_t channel;
+    uint8_t next = (scan_head + 1) & ADC_SCAN_RING_MASK;
+    /* ADC1BUF0 to ADC1BUF25 are consecutive, one per analog input. */
+    volatile uint16_t *buffer = &ADC1BUF0;
+
+    if(capturing == true)
+    {
+        IFS0bits.AD1IF = 0;
+
+        capture_buffer[capture_index] = ADC1BUF0;
+
+        if(++capture_index == capture_count)
+        {
+            T1CONbits.TON = 0;
+            AD1CON1bits.ASAM = 0;
+            IEC0bits.AD1IE = 0;
+            capture_done = true;
+
+            if(capture_callback != NULL)
+            {
+                capture_callback(capture_channel, capture_count, capture_context);
+            }
+        }
+        return;
+    }
+
+    if(scanning == false)
+    {
+        IFS0bits.AD1IF = 0;
+
+        if(oversampling == true)
+        {
+            /* A sample already started still converts, into ADC1BUF0,
+             * but only after the buffers have been summed. */
+            AD1CON1bits.ASAM = 0;
+            conversion_result = ADC_Decimate();
+        }
+        else
+        {
+            conversion_result = ADC1BUF0;
+        }
+        ADC_Filter(conversion_channel, conversion_result);
+        ADC_Compare(conversion_channel);
+#if defined(ADC_ENABLE_STATISTICS)
+        ADC_Accumulate(conversion_channel, conversion_result);
+#endif
+        conversion_ready = true;
+        conversion_busy = false;
+
+        if(conversion_callback != NULL)
+        {
+            conversion_callback(conversion_channel, conversion_result, conversion_context);
+        }
+        return;
+    }
+
+    for(channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+    {
+        if(enabled_channels & (1 << channel))
+        {
+            scan_ring[channel][next] = buffer[channels[channel].input];
+            ADC_Filter(channel, scan_ring[channel][next]);
+            ADC_Compare(channel);
+#if defined(ADC_ENABLE_STATISTICS)
+            ADC_Accumulate(channel, scan_ring[channel][next]);
+#endif
+        }
+    }
+
+    scan_head = next;
+    scan_count++;
+
+    IFS0bits.AD1IF = 0;
+}
+
+/*********************************************************************
+* Function: static bool ADC_IsEnabled(ADC_CHANNEL channel);
+*
+* Overview: Tells whether a channel exists and has been enabled.
+*
+* PreCondition: none
+*
+* Input: ADC_CHANNEL channel - the channel
+*
+* Output: bool - true if the channel can be converted
+*
+********************************************************************/
+static bool ADC_IsEnabled(ADC_CHANNEL channel)
+{
+    return (channel < ADC_CHANNEL_COUNT) && ((enabled_channels & (1 << channel)) != 0);
+}
+
+/*********************************************************************
+* Function: static void ADC_ScanStart(void);
+*
+* Overview: Loads the scan list from the enabled channels and starts the
+*           scan.  The ADC stays off while no channel is enabled.
+*
+* PreCondition: ADC_CONFIGURATION_SCAN set
+*
+* Input: None
+*
+* Output: None
+*
+********************************************************************/
+static void ADC_ScanStart(void)
+{
+    uint8_t channel;
+    uint8_t count = 0;
+    uint32_t select = 0;
+
+    IEC0bits.AD1IE = 0;
+    T1CONbits.TON = 0;
+    AD1CON1bits.ADON = 0;
+
+    for(channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+    {
+        if(enabled_channels & (1 << channel))
+        {
+            select |= (1ul << channels[channel].input);
+            count++;
+        }
+    }
+
+    AD1CSSL = (uint16_t)select;
+    AD1CSSH = (uint16_t)(select >> 16);
+    enabled_count = count;
+    scan_head = 0;
+    scan_count = 0;
+
+    if(count == 0)
+    {
+        return;
+    }
+
+    /* Interrupt once all channels of a scan are converted. */
+    AD1CON2bits.SMPI = count - 1;
+
+    IFS0bits.AD1IF = 0;
+    IEC0bits.AD1IE = 1;
+
+    AD1CON1bits.ADON = 1;
+
+    if(timed == true)
+    {
+        ADC_TimerStart(sample_rate * enabled_count);
+    }
+}
+
+/*********************************************************************
+* Function: static bool ADC_TimerStart(uint32_t rate);
+*
+* Overview: Runs Timer1 at a conversion rate, using the smallest
+*           prescaler that fits the period in 16 bits.
+*
+* PreCondition: ADC_CONFIGURATION_TIMED set or a burst being captured
+*
+* Input: rate - conversions per second; for a timed scan the per
+*        channel rate times the number of channels
+*
+* Output: bool - true if Timer1 was started, false otherwise
+*
+********************************************************************/
+static bool ADC_TimerStart(uint32_t rate)
+{
+    uint32_t counts;
+    uint16_t divider;
+
+    T1CON = 0;
+    TMR1 = 0;
+
+    if((rate == 0) || (rate > ADC_TIMED_MAX_CONVERSIONS))
+    {
+        return false;
+    }
+
+    counts = SYSTEM_PERIPHERAL_CLOCK / rate;
+    divider = TIMER_PRESCALER_1;
+
+    if(counts > 0x10000ul)
+    {
+        counts = SYSTEM_PERIPHERAL_CLOCK / 8 / rate;
+        divider = TIMER_PRESCALER_8;
+    }
+
+    if(counts > 0x10000ul)
+    {
+        counts = SYSTEM_PERIPHERAL_CLOCK / 64 / rate;
+        divider = TIMER_PRESCALER_64;
+    }
+
+    if(counts > 0x10000ul)
+    {
+        counts = SYSTEM_PERIPHERAL_CLOCK / 256 / rate;
+        divider = TIMER_PRESCALER_256;
+    }
+
+    if(counts > 0x10000ul)
+    {
+        return false;
+    }
+
+    /* The period is PR1 + 1 counts.  Only the match is used, to trigger
+     * the ADC, so the Timer1 interrupt stays off. */
+    PR1 = counts - 1;
+    T1CON = TIMER_ON | divider;
+
+    return true;
+}
+
+/*********************************************************************
+* Function: static uint16_t ADC_Decimate(void)
+*
+* Overview: Sums the ADC_OVERSAMPLE_COUNT results of an oversampled
+*           conversion and keeps ADC_OVERSAMPLE_BITS bits more than one
+*           conversion.  Each doubling of the count halves the noise
+*           power, so every four samples add one valid bit.
+*
+* PreCondition: Called from the ADC interrupt
+*
+* Input: None
+*
+* Output: uint16_t - the decimated result
+*
+********************************************************************/
+static uint16_t ADC_Decimate(void)
+{
+    uint8_t i;
+    uint32_t sum = 0;
+    volatile uint16_t *buffer = &ADC1BUF0;
+
+    for(i = 0; i < ADC_OVERSAMPLE_COUNT; i++)
+    {
+        sum += buffer[i];
+    }
+
+    return (uint16_t)(sum >> ADC_OVERSAMPLE_BITS);
+}
+
+/*********************************************************************
+* Function: static void ADC_Filter(ADC_CHANNEL channel, uint16_t sample)
+*
+* Overview: Runs the filter of a channel on a new sample.  The first
+*           sample after ADC_SetFilter() fills the whole history, so the
+*           output starts at the signal instead of rising from zero.
+*
+* PreCondition: Called from the ADC interrupt
+*
+* Input: channel - the channel
+*        sample - the new sample
+*
+* Output: None
+*
+********************************************************************/
+static void ADC_Filter(ADC_CHANNEL channel, uint16_t sample)
+{
+    ADC_FILTER *filter = &filters[channel];
+    uint8_t i;
+    int16_t error;
+
+    if(filter->primed == false)
+    {
+        for(i = 0; i < ADC_FILTER_MAX_TAPS; i++)
+        {
+            filter->history[i] = sample;
+        }
+
+        filter->index = 0;
+        filter->sum = (uint32_t)sample << filter->shift;
+        filter->state = (int32_t)sample * ADC_FILTER_Q15_ONE;
+        filter->output = sample;
+        filter->primed = true;
+        return;
+    }
+
+    switch(filter->type)
+    {
+        case ADC_FILTER_MOVING_AVERAGE:
+            /* The oldest sample leaves the sum as the new one enters. */
+            filter->index = (filter->index + 1) & (filter->parameter - 1);
+            filter->sum -= filter->history[filter->index];
+            filter->history[filter->index] = sample;
+            filter->sum += sample;
+            filter->output = (uint16_t)(filter->sum >> filter->shift);
+            break;
+
+        case ADC_FILTER_IIR:
+            /* Samples are at most 14 bits, so the error fits 16 bits and
+             * the product one 16 x 16 multiply. */
+            error = (int16_t)sample - (int16_t)((filter->state + ADC_FILTER_Q15_HALF) >> 15);
+            filter->state += (int32_t)error * (int16_t)filter->parameter;
+            filter->output = (uint16_t)((filter->state + ADC_FILTER_Q15_HALF) >> 15);
+            break;
+
+        case ADC_FILTER_MEDIAN:
+            filter->index = (filter->index + 1) % filter->parameter;
+            filter->history[filter->index] = sample;
+            filter->output = ADC_Median(filter);
+            break;
+
+        default:
+            filter->output = sample;
+            break;
+    }
+}
+
+/*********************************************************************
+* Function: static uint16_t ADC_Median(ADC_FILTER *filter)
+*
+* Overview: Finds the median of the 3 or 5 samples in the history by
+*           insertion sorting a copy.
+*
+* PreCondition: Called from the ADC interrupt
+*
+* Input: filter - the channel filter
+*
+* Output: uint16_t - the median
+*
+********************************************************************/
+static uint16_t ADC_Median(ADC_FILTER *filter)
+{
+    uint16_t sorted[5];
+    uint16_t value;
+    uint8_t i;
+    uint8_t j;
+
+    for(i = 0; i < filter->parameter; i++)
+    {
+        value = filter->history[i];
+
+        for(j = i; (j > 0) && (sorted[j - 1] > value); j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+
+        sorted[j] = value;
+    }
+
+    return sorted[filter->parameter / 2];
+}
+
+/*********************************************************************
+* Function: static void ADC_Compare(ADC_CHANNEL channel)
+*
+* Overview: Checks the filtered value of a channel against its window
+*           and calls back if the zone changed.  The edges are moved
+*           ADC_THRESHOLD_HYSTERESIS away from the current zone, so noise
+*           around an edge does not produce a train of callbacks.
+*
+* PreCondition: Called from the ADC interrupt after ADC_Filter()
+*
+* Input: channel - the channel
+*
+* Output: None
+*
+********************************************************************/
+static void ADC_Compare(ADC_CHANNEL channel)
+{
+    ADC_THRESHOLD *threshold = &thresholds[channel];
+    int32_t value = filters[channel].output;
+    int32_t low = threshold->low;
+    int32_t high = threshold->high;
+    uint8_t zone;
+
+    if(threshold->callback == NULL)
+    {
+        return;
+    }
+
+    switch(threshold->zone)
+    {
+        /* With a narrow window the moved edge may pass the other one,
+         * which then moves with it. */
+        case ADC_ZONE_BELOW:
+            low += ADC_THRESHOLD_HYSTERESIS;
+            if(high < low)
+            {
+                high = low;
+            }
+            break;
+
+        case ADC_ZONE_ABOVE:
+            high -= ADC_THRESHOLD_HYSTERESIS;
+            if(low > high)
+            {
+                low = high;
+            }
+            break;
+
+        case ADC_ZONE_INSIDE:
+            low -= ADC_THRESHOLD_HYSTERESIS;
+            high += ADC_THRESHOLD_HYSTERESIS;
+            break;
+
+        default:
+            break;
+    }
+
+    if(value < low)
+    {
+        zone = ADC_ZONE_BELOW;
+    }
+    else if(value > high)
+    {
+        zone = ADC_ZONE_ABOVE;
+    }
+    else
+    {
+        zone = ADC_ZONE_INSIDE;
+    }
+
+    if(zone != threshold->zone)
+    {
+        threshold->zone = zone;
+        threshold->callback(channel, (ADC_ZONE)zone, (uint16_t)value);
+    }
+}
+
+#if defined(ADC_ENABLE_STATISTICS)
+/*********************************************************************
+* Function: static void ADC_Accumulate(ADC_CHANNEL channel, uint16_t sample)
+*
+* Overview: Adds a sample to the statistics of a channel with Welford's
+*           update, which keeps the mean and the squared differences
+*           from it instead of a sum of squares, so the variance of a
+*           small noise on a large value does not cancel out.  The
+*           differences are taken to Q8 before squaring so the sum of
+*           full scale 14-bit swings over 65535 samples fits m2; the
+*           variance worked out from it needs the 64-bit variance_q8.
+*           The mean is updated rounded to nearest, as truncation would
+*           pull it towards zero by up to one Q16 step per sample.
+*
+* PreCondition: Called from the ADC interrupt
+*
+* Input: channel - the channel
+*        sample - the new sample
+*
+* Output: None
+*
+********************************************************************/
+static void ADC_Accumulate(ADC_CHANNEL channel, uint16_t sample)
+{
+    ADC_ACCUMULATOR *accumulator = &accumulators[channel];
+    int32_t x = (int32_t)sample << 16;
+    int32_t delta;
+
+    if(accumulator->count == 0xFFFF)
+    {
+        return;
+    }
+
+    if(accumulator->count == 0)
+    {
+        accumulator->min = sample;
+        accumulator->max = sample;
+    }
+    else if(sample < accumulator->min)
+    {
+        accumulator->min = sample;
+    }
+    else if(sample > accumulator->max)
+    {
+        accumulator->max = sample;
+    }
+
+    accumulator->count++;
+
+    delta = x - accumulator->mean;
+
+    if(delta >= 0)
+    {
+        accumulator->mean += (delta + (accumulator->count / 2)) / accumulator->count;
+    }
+    else
+    {
+        accumulator->mean -= ((accumulator->count / 2) - delta) / accumulator->count;
+    }
+
+    accumulator->m2 += (int64_t)(delta >> 8) * ((x - accumulator->mean) >> 8);
+}
+#endif
@@ -8,44 +8,448 @@
 
 #include <xc.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "uart2.h"
 
+#ifndef SYSTEM_PERIPHERAL_CLOCK
+#define SYSTEM_PERIPHERAL_CLOCK 16000000
+#pragma message "This module requires a definition for the peripheral clock frequency.  Assuming 16MHz Fcy (32MHz Fosc).  Define value if this is not correct."
+#endif
+
 // tris control for RTS pin
 #define TRTS TRISFbits.TRISF13
+// remappable input of the CTS pin, RF12
+#define CTS_RPI 32
 
 // timing and baud rate settings
 
-// 115200 baud (BREGH=1)
-#define BRATE 34
+#ifndef UART2_BAUD_RATE
+#define UART2_BAUD_RATE 115200
+#endif
+
+// BREGH=1: baud = Fcy / (4 * (BRATE + 1)), 34 for 115200 at 16MHz
+#define BRATE (((SYSTEM_PERIPHERAL_CLOCK + (2ul * UART2_BAUD_RATE)) / (4ul * UART2_BAUD_RATE)) - 1)
+#define BAUD_ACTUAL (SYSTEM_PERIPHERAL_CLOCK / (4ul * (BRATE + 1)))
+
+#if (BRATE > 0xFFFF)
+#error "UART2_BAUD_RATE cannot be reached from the peripheral clock."
+#endif
+
+#if (((BAUD_ACTUAL > UART2_BAUD_RATE) ? (BAUD_ACTUAL - UART2_BAUD_RATE) : (UART2_BAUD_RATE - BAUD_ACTUAL)) * 50 > UART2_BAUD_RATE)
+#error "UART2_BAUD_RATE is more than 2% off at this peripheral clock."
+#endif
+
 // enable the UART peripheral
 #define U_ENABLE 0x8008
+// UEN = 10: the UART holds transmission while CTS is high.  Its RTS output
+// is not mapped to a pin, RTS is driven from the receive queue level.
+#define U_FLOW 0x0200
 // enable transmission
 #define U_TX 0x0400
 
-// initialise the serial port (UART2, 115200, 8, N, 1, CTS/RTS )
+// transmit queue, a power of two up to 256
+#ifndef UART2_TX_BUFFER_SIZE
+#define UART2_TX_BUFFER_SIZE 128
+#endif
+
+#if ((UART2_TX_BUFFER_SIZE < 2) || (UART2_TX_BUFFER_SIZE > 256) || ((UART2_TX_BUFFER_SIZE & (UART2_TX_BUFFER_SIZE - 1)) != 0))
+#error "UART2_TX_BUFFER_SIZE must be a power of two from 2 to 256."
+#endif
+
+// what putU2() does when the transmit queue is full
+#define UART2_OVERFLOW_DROP 0   // drop the character and count it
+#define UART2_OVERFLOW_BLOCK 1  // wait for room, only from main context
+
+#ifndef UART2_TX_OVERFLOW
+#define UART2_TX_OVERFLOW UART2_OVERFLOW_DROP
+#endif
+
+// receive queue, a power of two up to 4096; at 115200 baud 256 bytes is
+// 22ms of input the application may leave unread
+#ifndef UART2_RX_BUFFER_SIZE
+#define UART2_RX_BUFFER_SIZE 256
+#endif
+
+#if ((UART2_RX_BUFFER_SIZE < 2) || (UART2_RX_BUFFER_SIZE > 4096) || ((UART2_RX_BUFFER_SIZE & (UART2_RX_BUFFER_SIZE - 1)) != 0))
+#error "UART2_RX_BUFFER_SIZE must be a power of two from 2 to 4096."
+#endif
+
+// DMAINTn<CHSEL> code of the UART2 transmitter, from the "DMA Channel
+// Trigger Sources" table in the DMA section of the PIC24FJ1024GA610/GB610
+// family data sheet (DS30010074).  With a wrong code the channel never
+// moves and only UART2_AbortDMA() frees it.
+#ifndef UART2_DMA_TRIGGER_TX
+#define UART2_DMA_TRIGGER_TX 0x19
+#endif
+
+// RTS is raised to stop the sender once this many characters wait, and
+// lowered again when reading brings them down to the low watermark.  The
+// room above the high watermark absorbs what the sender has in flight.
+#ifndef UART2_RX_HIGH_WATERMARK
+#define UART2_RX_HIGH_WATERMARK ((UART2_RX_BUFFER_SIZE * 3) / 4)
+#endif
+
+#ifndef UART2_RX_LOW_WATERMARK
+#define UART2_RX_LOW_WATERMARK (UART2_RX_BUFFER_SIZE / 4)
+#endif
+
+#if ((UART2_RX_HIGH_WATERMARK >= UART2_RX_BUFFER_SIZE) || (UART2_RX_LOW_WATERMARK >= UART2_RX_HIGH_WATERMARK))
+#error "UART2_RX watermarks must satisfy LOW < HIGH < UART2_RX_BUFFER_SIZE."
+#endif
+
+#define UART2_TX_MASK (UART2_TX_BUFFER_SIZE - 1)
+#define UART2_RX_MASK (UART2_RX_BUFFER_SIZE - 1)
+#define UART2_TX_PRIORITY 1
+// above the timers, so the 4 character hardware FIFO is emptied within
+// 40us even at 1M baud
+#define UART2_RX_PRIORITY 5
+#define UART2_DMA_PRIORITY 1
+// held by putU2() while it takes a queue slot, so that writers at any
+// priority, the RX handlers included, never share one
+#define UART2_IPL_ALL_MASKED 7
+
+// DMA channel 0: one-shot, byte transfers, source address incremented,
+// destination fixed at U2TXREG
+#define UART2_DMA_ONE_SHOT 0b00
+#define UART2_DMA_INCREMENT 0b01
+#define UART2_DMA_FIXED 0b00
+
+// written by putU2() only, with all interrupts masked
+static volatile uint8_t tx_head;
+// written by the TX interrupt only
+static volatile uint8_t tx_tail;
+static uint8_t tx_buffer[UART2_TX_BUFFER_SIZE];
+static volatile uint16_t tx_dropped;
+
+// written by the RX interrupt only
+static volatile uint16_t rx_head;
+// written by getU2() and read() only
+static volatile uint16_t rx_tail;
+static uint8_t rx_buffer[UART2_RX_BUFFER_SIZE];
+static volatile uint16_t rx_overruns;
+// RTS raised at the high watermark
+static volatile bool rx_stopped;
+
+// DMA transmit: dma_busy from UART2_SendDMA() until the done callback,
+// dma_active while the channel owns the UART
+static const uint8_t *dma_buffer;
+static uint16_t dma_length;
+static UART2_DMA_DONE dma_done;
+static volatile bool dma_busy;
+static volatile bool dma_active;
+
+static void UART2_DMAStart(void);
+
+// initialise the serial port (UART2, UART2_BAUD_RATE, 8, N, 1, CTS/RTS )
 void initU2()
 {
   RPINR19bits.U2RXR = 0x000A;    //RF4->UART2:U2RX
   RPOR8bits.RP17R = 0x0005;    //RF5->UART2:U2TX
+  RPINR19bits.U2CTSR = CTS_RPI;    //RF12->UART2:U2CTS
   U2BRG = BRATE;
-  U2MODE = U_ENABLE;
-  U2STA = U_TX;
+  U2MODE = U_ENABLE | U_FLOW;
+  U2STA = U_TX;     // TX interrupt while the FIFO has room (UTXISEL = 00)
   TRTS = 0;        // make RTS output
   RTS = 1;        // set RTS default status
+
+  tx_head = 0;
+  tx_tail = 0;
+  IPC7bits.U2TXIP = UART2_TX_PRIORITY;
+  IEC1bits.U2TXIE = 0;
+
+  rx_head = 0;
+  rx_tail = 0;
+  rx_stopped = false;
+  IPC7bits.U2RXIP = UART2_RX_PRIORITY;
+  IFS1bits.U2RXIF = 0;
+  IEC1bits.U2RXIE = 1;     // RX interrupt for every character (URXISEL = 00)
+
+  dma_busy = false;
+  dma_active = false;
+  DMACONbits.DMAEN = 1;
+  DMAL = 0x0800;           // DMA may read all of data RAM
+  DMAH = 0xFFFF;
+  IPC1bits.DMA0IP = UART2_DMA_PRIORITY;
+
+  RTS = 0;        // ready to receive
 }
 
-// send a character to the UART2 serial port
+// queue a character for the UART2 serial port, returns -1 if dropped.
+// Safe from main context and from interrupts of any priority.
 int putU2(int c)
 {
-  //while (CTS);                // wait for clear to send
-  while (U2STAbits.UTXBF);    // wait while Tx buffer full
-  U2TXREG = c;
+  uint8_t next;
+  int ipl;
+
+  for (;;)
+  {
+    // a writer preempting between the check and the head update would
+    // take the same slot, so both happen with the interrupts masked
+    SET_AND_SAVE_CPU_IPL(ipl, UART2_IPL_ALL_MASKED);
+    next = (tx_head + 1) & UART2_TX_MASK;
+    if (next != tx_tail)
+      break;
+
+#if (UART2_TX_OVERFLOW == UART2_OVERFLOW_BLOCK)
+    RESTORE_CPU_IPL(ipl);
+    // wait with the interrupts enabled for the TX interrupt to make room
+    while (((tx_head + 1) & UART2_TX_MASK) == tx_tail);
+#else
+    tx_dropped++;
+    RESTORE_CPU_IPL(ipl);
+    return -1;
+#endif
+  }
+
+  tx_buffer[tx_head] = c;
+  tx_head = next;             // publish after the data
+
+  // the interrupt stops itself when the queue runs dry, so restart it;
+  // the flag is set as it may have been cleared with the FIFO empty.
+  // While a DMA transfer owns the UART the done interrupt restarts it.
+  if (!dma_active)
+  {
+    IFS1bits.U2TXIF = 1;
+    IEC1bits.U2TXIE = 1;
+  }
+
+  RESTORE_CPU_IPL(ipl);
   return c;
 }
 
+// send a buffer by DMA without copying it; the buffer must stay untouched
+// until done is called from the DMA interrupt
+bool UART2_SendDMA(const void *buffer, uint16_t len, UART2_DMA_DONE done)
+{
+  int ipl;
+
+  if (len == 0)
+    return false;
+
+  // a putU2() from an interrupt could otherwise restart the TX interrupt
+  // between the check and the start, and both would start the channel
+  SET_AND_SAVE_CPU_IPL(ipl, UART2_IPL_ALL_MASKED);
+  if (dma_busy)
+  {
+    RESTORE_CPU_IPL(ipl);
+    return false;
+  }
+
+  dma_buffer = buffer;
+  dma_length = len;
+  dma_done = done;
+  dma_busy = true;
+
+  // characters already queued go first, the TX interrupt starts the
+  // transfer once they are in the FIFO
+  if (tx_tail == tx_head)
+    UART2_DMAStart();
+  else
+  {
+    IFS1bits.U2TXIF = 1;
+    IEC1bits.U2TXIE = 1;
+  }
+
+  RESTORE_CPU_IPL(ipl);
+  return true;
+}
+
+// true from UART2_SendDMA() until its done callback
+bool UART2_IsDMABusy(void)
+{
+  return dma_busy;
+}
+
+// program DMA channel 0 to feed U2TXREG on every UART2 transmit event
+static void UART2_DMAStart(void)
+{
+  dma_active = true;
+
+  DMACH0 = 0;
+  DMACH0bits.SIZE = 1;
+  DMACH0bits.TRMODE = UART2_DMA_ONE_SHOT;
+  DMACH0bits.SAMODE = UART2_DMA_INCREMENT;
+  DMACH0bits.DAMODE = UART2_DMA_FIXED;
+  DMAINT0 = 0;
+  DMAINT0bits.CHSEL = UART2_DMA_TRIGGER_TX;
+  DMASRC0 = (uint16_t)dma_buffer;
+  DMADST0 = (uint16_t)&U2TXREG;
+  DMACNT0 = dma_length;
+
+  IFS0bits.DMA0IF = 0;
+  IEC0bits.DMA0IE = 1;
+  DMACH0bits.CHEN = 1;
+
+  // every character leaving the FIFO raises a transmit event, so while the
+  // FIFO is full (or held by CTS) the next event moves the first byte.  A
+  // forced write now would be dropped.  With room in the FIFO there may be
+  // no further event, so the first byte is forced.
+  if (!U2STAbits.UTXBF)
+    DMACH0bits.CHREQ = 1;
+}
+
+// the last byte is in the FIFO: hand the UART back to the queue
+void __attribute__((__interrupt__, auto_psv)) _DMA0Interrupt(void)
+{
+  UART2_DMA_DONE done = dma_done;
+
+  IFS0bits.DMA0IF = 0;
+  DMAINT0bits.DONEIF = 0;
+  IEC0bits.DMA0IE = 0;
+  DMACH0bits.CHEN = 0;
+
+  dma_active = false;
+  dma_busy = false;
+
+  if (tx_tail != tx_head)
+  {
+    IFS1bits.U2TXIF = 1;
+    IEC1bits.U2TXIE = 1;
+  }
+
+  if (done != NULL)
+    done();
+}
+
+// stop a transfer that has not finished, e.g. one that has made no progress
+// for longer than its bytes take to send; done is not called
+bool UART2_AbortDMA(void)
+{
+  int ipl;
+  bool aborted;
+
+  SET_AND_SAVE_CPU_IPL(ipl, UART2_IPL_ALL_MASKED);
+  aborted = dma_busy;
+  if (dma_active)
+  {
+    DMACH0bits.CHEN = 0;
+    IEC0bits.DMA0IE = 0;
+    IFS0bits.DMA0IF = 0;
+  }
+  dma_active = false;
+  dma_busy = false;
+
+  // hand the UART back to the queue, as the done interrupt would
+  if (tx_tail != tx_head)
+  {
+    IFS1bits.U2TXIF = 1;
+    IEC1bits.U2TXIE = 1;
+  }
+  RESTORE_CPU_IPL(ipl);
+
+  return aborted;
+}
+
+// number of characters dropped because the transmit queue was full
+uint16_t UART2_GetTxDropped(void)
+{
+  return tx_dropped;
+}
+
+// number of received characters waiting to be read
+uint16_t UART2_Available(void)
+{
+  return (rx_head - rx_tail) & UART2_RX_MASK;
+}
+
+// wait for a character from the UART2 serial port
+int getU2(void)
+{
+  uint8_t c;
+
+  while (rx_tail == rx_head);   // wait for the interrupt to queue one
+  c = rx_buffer[rx_tail];
+  rx_tail = (rx_tail + 1) & UART2_RX_MASK;   // free the slot after the read
+
+  if (rx_stopped)
+  {
+    IEC1bits.U2RXIE = 0;    // the interrupt also drives RTS
+    if (rx_stopped && (UART2_Available() <= UART2_RX_LOW_WATERMARK))
+    {
+      rx_stopped = false;
+      RTS = 0;
+    }
+    IEC1bits.U2RXIE = 1;
+  }
+  return c;
+}
+
+// characters lost because the receive queue or the hardware FIFO was full
+uint16_t UART2_GetRxOverruns(void)
+{
+  return rx_overruns;
+}
+
+// move received characters from the hardware FIFO into the queue
+void __attribute__((__interrupt__, auto_psv)) _U2RXInterrupt(void)
+{
+  uint16_t next;
+  uint8_t c;
+
+  IFS1bits.U2RXIF = 0;
+
+  while (U2STAbits.URXDA)
+  {
+    c = U2RXREG;
+    next = (rx_head + 1) & UART2_RX_MASK;
+
+    if (next == rx_tail)
+    {
+      rx_overruns++;
+    }
+    else
+    {
+      rx_buffer[rx_head] = c;
+      rx_head = next;          // publish after the data
+    }
+  }
+
+  if (!rx_stopped && (UART2_Available() >= UART2_RX_HIGH_WATERMARK))
+  {
+    rx_stopped = true;
+    RTS = 1;                   // ask the sender to pause
+  }
+
+  // an overrun stops reception until OERR is cleared, which also empties
+  // the FIFO
+  if (U2STAbits.OERR)
+  {
+    U2STAbits.OERR = 0;
+    rx_overruns++;
+  }
+}
+
+// move queued characters into the hardware FIFO
+void __attribute__((__interrupt__, auto_psv)) _U2TXInterrupt(void)
+{
+  int ipl;
+
+  IFS1bits.U2TXIF = 0;
+
+  while ((tx_tail != tx_head) && !U2STAbits.UTXBF)
+  {
+    U2TXREG = tx_buffer[tx_tail];
+    tx_tail = (tx_tail + 1) & UART2_TX_MASK;
+  }
+
+  // decided with all interrupts masked, like putU2() and UART2_SendDMA(),
+  // so no writer can queue between the check and the DMA start
+  SET_AND_SAVE_CPU_IPL(ipl, UART2_IPL_ALL_MASKED);
+  if (tx_tail == tx_head)
+  {
+    IEC1bits.U2TXIE = 0;
+    if (dma_busy && !dma_active)
+      UART2_DMAStart();
+  }
+  RESTORE_CPU_IPL(ipl);
+}
+
+// queues the characters and returns without waiting for them to be sent;
+// with UART2_OVERFLOW_DROP the count stops at the first dropped one
 int write(int handle, void *buffer, unsigned int len)
 {
-  int i;
+  unsigned int i;
 
   switch (handle)
   {
@@ -53,8 +457,11 @@ int write(int handle, void *buffer, unsigned int len)
       case 1:
       case 2:
       // case for stdout output
-      for (i = len; i; --i)
-          putU2( *(char*)buffer++);
+      for (i = 0; i < len; i++)
+      {
+          if (putU2( ((char*)buffer)[i]) == -1)
+              return (int)i;
+      }
       break;
 
   default:
@@ -62,4 +469,26 @@ int write(int handle, void *buffer, unsigned int len)
   }
 
   return(len);
-}
\ No newline at end of file
+}
+// blocks for the first character, then returns those already received
+int read(int handle, void *buffer, unsigned int len)
+{
+  unsigned int i = 0;
+
+  switch (handle)
+  {
+      case 0:
+      // case for stdin input
+      if (len == 0)
+          break;
+      ((char*)buffer)[i++] = getU2();
+      while ((i < len) && (UART2_Available() != 0))
+          ((char*)buffer)[i++] = getU2();
+      break;
+
+  default:
+      break;
+  }
+
+  return (int)i;
+}
@@ -40,6 +40,38 @@
 #define CTS _RF12
 // request To Send, output, HW handshake
 #define RTS _RF13
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// called from the DMA interrupt when UART2_SendDMA() has finished
+typedef void (*UART2_DMA_DONE)(void);
+
+// initialise the serial port (UART2, UART2_BAUD_RATE, 8, N, 1, CTS/RTS )
+void initU2(void);
+// queue a character to send, returns it or -1 if the queue was full.
+// May be called from main context and from interrupts of any priority.
+int putU2(int c);
+// characters dropped on a full transmit queue since start up
+uint16_t UART2_GetTxDropped(void);
+// wait for a received character and return it
+int getU2(void);
+// number of received characters waiting, does not block
+uint16_t UART2_Available(void);
+// received characters lost to a full queue or hardware overrun
+uint16_t UART2_GetRxOverruns(void);
+// send len bytes from a RAM buffer by DMA, after anything already queued,
+// without copying; false if a transfer is in progress.  The buffer must
+// be left alone until done (may be NULL) is called.
+bool UART2_SendDMA(const void *buffer, uint16_t len, UART2_DMA_DONE done);
+// true while a UART2_SendDMA() transfer is in progress
+bool UART2_IsDMABusy(void);
+// stop a transfer that is not finishing, e.g. after len * 10 / baud
+// seconds plus a margin for CTS; done is not called.  false if none was
+// in progress
+bool UART2_AbortDMA(void);
+// stdio hook, queues len bytes for stdout and stderr
+int write(int handle, void *buffer, unsigned int len);
 // TODO Insert declarations
 
 // Comment a function and leverage automatic documentation with slash star star
@@ -78,12 +110,3 @@ extern "C" {
 #endif /* __cplusplus */
 
 #endif	/* XC_HEADER_TEMPLATE_H */
-
-// initialise the serial port (UART2, 115200@32MHz, 8, N, 1, CTS/RTS )
-void initU2();
-
-// send a character to the serial port
-int putU2( int c);
-
-// send a string to the serial port
-int write(int handle, void *buffer, unsigned int len);
\ No newline at end of file
@@ -16,20 +16,24 @@
 #include "bsp/leds.h"
 #include "bsp/timer_1ms.h"
 #include "bsp/uart2.h"
+#include "bsp/scheduler.h"
+
+#define TASK_BLINK 0
 
 static void TimerEventHandler( void );
 
 int main(void) {
     LED_Enable ( LED_D10 );
     /* Get a timer event once every 100ms for the blink alive. */
-    TIMER_SetConfiguration ( TIMER_CONFIGURATION_1MS );
-    TIMER_RequestTick( &TimerEventHandler, 1000 );
+    TIMER_SetConfiguration ( TIMER_CONFIGURATION_TICKLESS );
+    /* The handler writes to the UART, so run it as a task rather than
+     * from the timer ISR. */
+    SCHEDULER_TaskCreate( TASK_BLINK, &TimerEventHandler );
+    SCHEDULER_PostEvery( TASK_BLINK, 1000 );
     initU2();
-    while(1)
-    {
-
-    }
 
+    /* Sleeps until the next timer deadline whenever nothing is ready. */
+    SCHEDULER_Run();
 }
 
 static void TimerEventHandler(void)
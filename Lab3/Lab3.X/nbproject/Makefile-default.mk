@@ -57,17 +57,17 @@ OBJECTDIR=build/${CND_CONF}/${IMAGE_TYPE}
 DISTDIR=dist/${CND_CONF}/${IMAGE_TYPE}
 
 # Source Files Quoted if spaced
-SOURCEFILES_QUOTED_IF_SPACED=bsp/timer_1ms.c bsp/leds.c bsp/buttons.c bsp/uart2.c main.c system.c
+SOURCEFILES_QUOTED_IF_SPACED=bsp/timer_1ms.c bsp/scheduler.c bsp/leds.c bsp/buttons.c bsp/uart2.c main.c system.c
 
 # Object Files Quoted if spaced
-OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/bsp/timer_1ms.o ${OBJECTDIR}/bsp/leds.o ${OBJECTDIR}/bsp/buttons.o ${OBJECTDIR}/bsp/uart2.o ${OBJECTDIR}/main.o ${OBJECTDIR}/system.o
-POSSIBLE_DEPFILES=${OBJECTDIR}/bsp/timer_1ms.o.d ${OBJECTDIR}/bsp/leds.o.d ${OBJECTDIR}/bsp/buttons.o.d ${OBJECTDIR}/bsp/uart2.o.d ${OBJECTDIR}/main.o.d ${OBJECTDIR}/system.o.d
+OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/bsp/timer_1ms.o ${OBJECTDIR}/bsp/scheduler.o ${OBJECTDIR}/bsp/leds.o ${OBJECTDIR}/bsp/buttons.o ${OBJECTDIR}/bsp/uart2.o ${OBJECTDIR}/main.o ${OBJECTDIR}/system.o
+POSSIBLE_DEPFILES=${OBJECTDIR}/bsp/timer_1ms.o.d ${OBJECTDIR}/bsp/scheduler.o.d ${OBJECTDIR}/bsp/leds.o.d ${OBJECTDIR}/bsp/buttons.o.d ${OBJECTDIR}/bsp/uart2.o.d ${OBJECTDIR}/main.o.d ${OBJECTDIR}/system.o.d
 
 # Object Files
-OBJECTFILES=${OBJECTDIR}/bsp/timer_1ms.o ${OBJECTDIR}/bsp/leds.o ${OBJECTDIR}/bsp/buttons.o ${OBJECTDIR}/bsp/uart2.o ${OBJECTDIR}/main.o ${OBJECTDIR}/system.o
+OBJECTFILES=${OBJECTDIR}/bsp/timer_1ms.o ${OBJECTDIR}/bsp/scheduler.o ${OBJECTDIR}/bsp/leds.o ${OBJECTDIR}/bsp/buttons.o ${OBJECTDIR}/bsp/uart2.o ${OBJECTDIR}/main.o ${OBJECTDIR}/system.o
 
 # Source Files
-SOURCEFILES=bsp/timer_1ms.c bsp/leds.c bsp/buttons.c bsp/uart2.c main.c system.c
+SOURCEFILES=bsp/timer_1ms.c bsp/scheduler.c bsp/leds.c bsp/buttons.c bsp/uart2.c main.c system.c
 
 
 
@@ -102,6 +102,13 @@ ${OBJECTDIR}/bsp/timer_1ms.o: bsp/timer_1ms.c  nbproject/Makefile-${CND_CONF}.mk
 	${MP_CC} $(MP_EXTRA_CC_PRE)  bsp/timer_1ms.c  -o ${OBJECTDIR}/bsp/timer_1ms.o  -c -mcpu=$(MP_PROCESSOR_OPTION)  -MMD -MF "${OBJECTDIR}/bsp/timer_1ms.o.d"      -g -D__DEBUG -D__MPLAB_DEBUGGER_PK3=1  -mno-eds-warn  -omf=elf -DXPRJ_default=$(CND_CONF)  -legacy-libc  $(COMPARISON_BUILD)  -O0 -msmart-io=1 -Wall -msfr-warn=off  
 	@${FIXDEPS} "${OBJECTDIR}/bsp/timer_1ms.o.d" $(SILENT)  -rsi ${MP_CC_DIR}../ 
 	
+${OBJECTDIR}/bsp/scheduler.o: bsp/scheduler.c  nbproject/Makefile-${CND_CONF}.mk
+	@${MKDIR} "${OBJECTDIR}/bsp" 
+	@${RM} ${OBJECTDIR}/bsp/scheduler.o.d 
+	@${RM} ${OBJECTDIR}/bsp/scheduler.o 
+	${MP_CC} $(MP_EXTRA_CC_PRE)  bsp/scheduler.c  -o ${OBJECTDIR}/bsp/scheduler.o  -c -mcpu=$(MP_PROCESSOR_OPTION)  -MMD -MF "${OBJECTDIR}/bsp/scheduler.o.d"      -g -D__DEBUG -D__MPLAB_DEBUGGER_PK3=1  -mno-eds-warn  -omf=elf -DXPRJ_default=$(CND_CONF)  -legacy-libc  $(COMPARISON_BUILD)  -O0 -msmart-io=1 -Wall -msfr-warn=off  
+	@${FIXDEPS} "${OBJECTDIR}/bsp/scheduler.o.d" $(SILENT)  -rsi ${MP_CC_DIR}../ 
+	
 ${OBJECTDIR}/bsp/leds.o: bsp/leds.c  nbproject/Makefile-${CND_CONF}.mk
 	@${MKDIR} "${OBJECTDIR}/bsp" 
 	@${RM} ${OBJECTDIR}/bsp/leds.o.d 
@@ -145,6 +152,13 @@ ${OBJECTDIR}/bsp/timer_1ms.o: bsp/timer_1ms.c  nbproject/Makefile-${CND_CONF}.mk
 	${MP_CC} $(MP_EXTRA_CC_PRE)  bsp/timer_1ms.c  -o ${OBJECTDIR}/bsp/timer_1ms.o  -c -mcpu=$(MP_PROCESSOR_OPTION)  -MMD -MF "${OBJECTDIR}/bsp/timer_1ms.o.d"      -mno-eds-warn  -g -omf=elf -DXPRJ_default=$(CND_CONF)  -legacy-libc  $(COMPARISON_BUILD)  -O0 -msmart-io=1 -Wall -msfr-warn=off  
 	@${FIXDEPS} "${OBJECTDIR}/bsp/timer_1ms.o.d" $(SILENT)  -rsi ${MP_CC_DIR}../ 
 	
+${OBJECTDIR}/bsp/scheduler.o: bsp/scheduler.c  nbproject/Makefile-${CND_CONF}.mk
+	@${MKDIR} "${OBJECTDIR}/bsp" 
+	@${RM} ${OBJECTDIR}/bsp/scheduler.o.d 
+	@${RM} ${OBJECTDIR}/bsp/scheduler.o 
+	${MP_CC} $(MP_EXTRA_CC_PRE)  bsp/scheduler.c  -o ${OBJECTDIR}/bsp/scheduler.o  -c -mcpu=$(MP_PROCESSOR_OPTION)  -MMD -MF "${OBJECTDIR}/bsp/scheduler.o.d"      -mno-eds-warn  -g -omf=elf -DXPRJ_default=$(CND_CONF)  -legacy-libc  $(COMPARISON_BUILD)  -O0 -msmart-io=1 -Wall -msfr-warn=off  
+	@${FIXDEPS} "${OBJECTDIR}/bsp/scheduler.o.d" $(SILENT)  -rsi ${MP_CC_DIR}../ 
+	
 ${OBJECTDIR}/bsp/leds.o: bsp/leds.c  nbproject/Makefile-${CND_CONF}.mk
 	@${MKDIR} "${OBJECTDIR}/bsp" 
 	@${RM} ${OBJECTDIR}/bsp/leds.o.d 